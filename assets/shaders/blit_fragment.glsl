@@ -0,0 +1,14 @@
+#version 410 core
+
+in vec2 v_UV;
+out vec4 FragColor;
+
+// One texel per CHIP-8 pixel, row 0 at v = 0
+uniform sampler2D u_Display;
+uniform vec3 u_PixelOn;
+uniform vec3 u_PixelOff;
+
+void main() {
+    bool lit = texture(u_Display, v_UV).r > 0.0f;
+    FragColor = vec4(lit ? u_PixelOn : u_PixelOff, 1.0f);
+}
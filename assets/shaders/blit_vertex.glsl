@@ -0,0 +1,10 @@
+#version 410 core
+
+layout (location = 0) in vec3 aPos;
+
+out vec2 v_UV;
+
+void main() {
+    v_UV = aPos.xy * 0.5f + 0.5f;
+    gl_Position = vec4(aPos.xy, 0.0f, 1.0f);
+}
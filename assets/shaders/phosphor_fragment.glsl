@@ -0,0 +1,20 @@
+#version 410 core
+
+in vec2 v_UV;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float Intensity; // Becomes u_History of the next pass
+
+// One texel per CHIP-8 pixel, row 0 at v = 0
+uniform sampler2D u_Display;
+uniform sampler2D u_History;
+// Share of its previous intensity an unlit pixel keeps, already raised to the emulated frames elapsed
+uniform float u_Decay;
+uniform vec3 u_PixelOn;
+uniform vec3 u_PixelOff;
+
+void main() {
+    bool lit = texture(u_Display, v_UV).r > 0.0f;
+    float intensity = lit ? 1.0f : texture(u_History, v_UV).r * u_Decay;
+    Intensity = intensity;
+    FragColor = vec4(mix(u_PixelOff, u_PixelOn, intensity), 1.0f);
+}
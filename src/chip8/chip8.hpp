@@ -1,24 +1,35 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <random>
 #include <stack>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-#include "../audio.hpp"
-#include "../constants.hpp"
 #include "../log.hpp"
-#include "../utils.hpp"
+#include "chip8_constants.hpp"
+#include "chip8_display.hpp"
 #include "chip8_types.hpp"
 
+// Set to 1 (CMake option CHIP8_PROFILE) to build in the execution counters of Chip8::profile
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
 namespace CHIP8 {
 struct Chip8Config {
     /*
@@ -49,58 +60,9 @@ struct Chip8Config {
     https://tobiasvl.github.io/blog/write-a-chip-8-emulator/#fx55-and-fx65-store-and-load-memory
     */
     bool legacy_memory_dump = false;
-};
-struct Chip8 {
-    std::array<BYTE, 4 * 1024> mem = {};
-    std::array<std::array<PIXEL, 64>, 32> display = {};
-    WORD PC = 0;
-    WORD I = 0;             // index register
-    int stack_pointer = -1; // If init to 0 we would never actually use 0, wasting one slot
-    std::array<WORD, 32> stack = {};
-    BYTE delay_timer = 0;
-    BYTE sound_timer = 0;
-    std::chrono::steady_clock::time_point last_timer_update;
-    std::array<BYTE, 16> VX{};
-    int iteration_counter = 0;
-    Chip8Config config;
-    std::array<bool, 16> keypad = {};
-    std::array<bool, 16> just_pressed = {};
-};
-inline Chip8 chip8;
 
-inline constexpr BYTE field_X(WORD w) { return (w >> 8) & 0xF; }
-inline constexpr BYTE field_Y(WORD w) { return (w >> 4) & 0xF; }
-inline constexpr BYTE field_N(WORD w) { return w & 0xF; }
-inline constexpr BYTE field_NN(WORD w) { return w & 0xFF; }
-inline constexpr WORD field_NNN(WORD w) { return w & 0x0FFF; }
-
-inline auto clear_display(Chip8 &c) -> void {
-    for (auto &row : c.display) {
-        row.fill(0);
-    }
-}
-inline auto draw_sprite(Chip8 &c, WORD w) -> void {
-    const BYTE x0 = c.VX[field_X(w)] % 64;
-    const BYTE y0 = c.VX[field_Y(w)] % 32;
-
-    c.VX[0xF] = 0;
-    for (int row = 0; row < field_N(w); ++row) {
-        const uint8_t sprite = c.mem[c.I + row];
-
-        for (int bit = 0; bit < 8; ++bit) {
-            const BYTE xx = (x0 + bit) & 63;
-            const BYTE yy = (y0 + row) & 31;
-            const PIXEL px = (sprite >> (7 - bit)) & 1;
-
-            PIXEL &dst = c.display[yy][xx];
-            if (dst && px) c.VX[0xF] = 1;
-            dst ^= px;
-        }
-    }
-}
-
-using ExecFn = void (*)(Chip8 &, WORD);
-using EncodeFn = WORD (*)(WORD X, WORD Y, WORD N, WORD NN, WORD NNN);
+    bool operator==(const Chip8Config &) const = default;
+};
 
 enum class Op {
     cls,
@@ -140,6 +102,217 @@ enum class Op {
     sys,
 };
 
+struct Chip8;
+
+/* An instruction word together with its pre-extracted operand fields. */
+struct Instr {
+    WORD w;
+    WORD NNN;
+    BYTE X;
+    BYTE Y;
+    BYTE N;
+    BYTE NN;
+};
+
+using ExecFn = void (*)(Chip8 &, Instr);
+
+/* Cached decode of the instruction starting at a given address, `exec == nullptr` means not decoded. */
+struct DecodedInstr {
+    ExecFn exec = nullptr;
+    Instr ins{};
+    Op id = Op::sys;  // Undecodable words are stored as Op::sys with a panicking `exec`
+    BYTE fusion = 0;  // 1 + index into FUSIONS if a superinstruction starts here, else 0
+};
+
+/*
+DecodedInstr per address, indexed like `mem`. Derived state, so it lives on the heap and copies of a
+machine start without it, like the JIT blocks: copying a machine stays as cheap as copying its state.
+*/
+class DecodeCache {
+public:
+    DecodeCache() = default;
+    DecodeCache(const DecodeCache &) {}
+    DecodeCache(DecodeCache &&) noexcept = default;
+    auto operator=(const DecodeCache &other) -> DecodeCache & {
+        if (this != &other) clear();
+        return *this;
+    }
+    auto operator=(DecodeCache &&) noexcept -> DecodeCache & = default;
+    ~DecodeCache() = default;
+
+    static constexpr auto size() -> size_t { return 4 * 1024; }
+    /* Allocated, with nothing decoded, on first access. */
+    auto operator[](size_t addr) -> DecodedInstr & {
+        if (!m_entries) [[unlikely]] m_entries = std::make_unique<DecodedInstr[]>(size());
+        return m_entries[addr];
+    }
+    [[nodiscard]] auto empty() const -> bool { return !m_entries; }
+    auto clear() -> void { m_entries.reset(); }
+
+private:
+    std::unique_ptr<DecodedInstr[]> m_entries;
+};
+
+#if CHIP8_PROFILE
+inline constexpr size_t op_count = static_cast<size_t>(Op::sys) + 1;
+
+/*
+Where a ROM spends its time, counted by fetch_and_execute while Chip8::profiling is set. A basic
+block starts wherever execution doesn't continue at the next word (jumps, calls, returns, taken
+skips), the call tree follows CALL / RET and gives the folded stacks (see chip8_profile.hpp).
+*/
+struct Profile {
+    struct CallNode {
+        WORD entry;      // Called address, rom_program_start for the root
+        uint32_t parent; // Index into `calls`
+        uint64_t count;  // Instructions executed with exactly this call stack
+    };
+
+    std::array<uint64_t, op_count> per_op{};
+    std::array<uint64_t, 4 * 1024> per_pc{};
+    std::array<uint64_t, 4 * 1024> per_block{}; // Entries into the block starting at that address
+    WORD next_pc = 0xFFFF;                       // Where execution continues without a branch
+    std::vector<CallNode> calls = {CallNode{CONSTANTS::rom_program_start, 0, 0}};
+    std::unordered_map<uint32_t, uint32_t> children; // parent << 16 | entry -> index into `calls`
+    uint32_t current = 0;                            // Node of the running call stack
+};
+#endif
+
+/* Longest instruction sequence a superinstruction covers, a cached decode depends on this many words. */
+inline constexpr size_t max_fused_length = 3;
+
+/* How `step` dispatches instructions, both engines produce identical state. */
+enum class Dispatch {
+    table,    // Indirect call through the cached OpInfo::exec
+    switched, // Single switch over Op with the handlers inlined
+    jit,      // Basic blocks recompiled to native code, falls back to `table` where unsupported
+};
+
+/* What drives the delay and sound timers, each ticks them at 60Hz of a different clock. */
+enum class TimerMode : BYTE {
+    host,         // Nothing inside the core, the host calls end_frame / tick_timers, e.g. the Scheduler
+    realtime,     // Wall-clock time, read at the start of every `step`
+    instructions, // Emulated time, one tick per `instructions_per_tick` executed instructions
+};
+
+namespace JIT {
+class BlockCache;
+
+/* Holds a machine's compiled blocks. Copies of a machine start without any, blocks belong to the machine that compiled them. */
+class CacheHandle {
+public:
+    CacheHandle();
+    CacheHandle(const CacheHandle &);
+    CacheHandle(CacheHandle &&) noexcept;
+    auto operator=(const CacheHandle &) -> CacheHandle &;
+    auto operator=(CacheHandle &&) noexcept -> CacheHandle &;
+    ~CacheHandle();
+
+    std::unique_ptr<BlockCache> cache; // Created lazily by run_jit
+};
+} // namespace JIT
+
+struct Chip8 {
+    std::array<BYTE, 4 * 1024> mem = {};
+    Display display = {};
+    uint32_t dirty_rows = 0; // Bit y is set when display row y may have changed since take_dirty_rows
+    WORD PC = 0;
+    WORD I = 0;             // index register
+    int stack_pointer = -1; // If init to 0 we would never actually use 0, wasting one slot
+    std::array<WORD, 32> stack = {};
+    BYTE delay_timer = 0;
+    BYTE sound_timer = 0;
+    std::chrono::steady_clock::time_point last_timer_update;
+    std::array<BYTE, 16> VX{};
+    uint64_t iteration_counter = 0; // Instructions accounted for, executed or fast-forwarded
+    Chip8Config config;
+    std::array<bool, 16> keypad = {};
+    std::array<bool, 16> just_pressed = {};
+    uint64_t rng_state = 0x853C49E6748FEA9B; // See random_byte, reseeded by initialise
+    // Indexed by address, must be invalidated whenever the bytes it was decoded from change
+    DecodeCache decoded;
+    // Bumped whenever a write drops a cached decode, i.e. whenever code that may have been compiled changes
+    uint32_t code_epoch = 0;
+    Dispatch dispatch = Dispatch::table;
+    bool fuse_superinstructions = false; // Only affects Dispatch::table
+    bool idle = false;                   // Last `step` executed nothing, it only fast-forwarded an idle loop
+    uint64_t instructions_skipped = 0;   // Fast-forwarded by fast_forward_idle, counted in iteration_counter too
+    TimerMode timer_mode = TimerMode::realtime;
+    uint32_t instructions_per_tick = CONSTANTS::n_iter_per_frame; // TimerMode::instructions only
+    uint32_t tick_phase = 0; // Instructions executed since the last tick, TimerMode::instructions only
+    JIT::CacheHandle jit;
+#if CHIP8_PROFILE
+    bool profiling = false; // Engines fall back to fetch_and_execute, which counts into `profile`
+    Profile profile;
+#endif
+};
+
+inline constexpr BYTE field_X(WORD w) { return (w >> 8) & 0xF; }
+inline constexpr BYTE field_Y(WORD w) { return (w >> 4) & 0xF; }
+inline constexpr BYTE field_N(WORD w) { return w & 0xF; }
+inline constexpr BYTE field_NN(WORD w) { return static_cast<BYTE>(w & 0xFF); }
+inline constexpr WORD field_NNN(WORD w) { return w & 0x0FFF; }
+
+inline constexpr auto make_instr(WORD w) -> Instr {
+    return Instr{w, field_NNN(w), field_X(w), field_Y(w), field_N(w), field_NN(w)};
+}
+
+/* Drops every cached decode that overlaps the bytes [addr, addr + len). Call after writing to `mem`. */
+inline auto invalidate_decoded(Chip8 &c, size_t addr, size_t len) -> void {
+    // Decodes starting up to this many bytes earlier read addr too (superinstructions look ahead)
+    constexpr size_t reach = 2 * max_fused_length - 1;
+    if (c.decoded.empty()) return;
+    const size_t first = (addr > reach) ? addr - reach : 0;
+    const size_t last = std::min(addr + len, c.decoded.size());
+    bool dropped = false;
+    for (size_t a = first; a < last; ++a) {
+        if (c.decoded[a].exec) {
+            c.decoded[a].exec = nullptr;
+            dropped = true;
+        }
+    }
+    if (dropped) ++c.code_epoch;
+}
+
+inline auto pixel_mask(int x) -> DisplayRow { return DisplayRow{1} << (display_width - 1 - x); }
+inline auto get_pixel(const Display &d, int x, int y) -> PIXEL {
+    return (d[static_cast<size_t>(y)] & pixel_mask(x)) ? 1 : 0;
+}
+inline auto get_pixel(const Chip8 &c, int x, int y) -> PIXEL { return get_pixel(c.display, x, y); }
+inline auto toggle_pixel(Chip8 &c, int x, int y) -> void {
+    c.display[static_cast<size_t>(y)] ^= pixel_mask(x);
+    c.dirty_rows |= uint32_t{1} << y;
+}
+
+static_assert(display_height == 32, "dirty_rows has one bit per row");
+/* Returns the rows changed since the last call and clears the mask, for whoever presents the display. */
+inline auto take_dirty_rows(Chip8 &c) -> uint32_t { return std::exchange(c.dirty_rows, 0); }
+
+inline auto expand_display(const Display &display) -> ByteDisplay {
+    ByteDisplay out;
+    for (size_t y = 0; y < out.size(); ++y) {
+        for (size_t x = 0; x < out[y].size(); ++x) {
+            out[y][x] = (display[y] >> (out[y].size() - 1 - x)) & 1;
+        }
+    }
+    return out;
+}
+
+inline auto clear_display(Chip8 &c) -> void {
+    display_kernels.clear(c.display);
+    c.dirty_rows = ~uint32_t{0};
+}
+/* Sprites wrap around on both axes, VF is set if any lit pixel got turned off. */
+inline auto draw_sprite(Chip8 &c, BYTE X, BYTE Y, BYTE N) -> void {
+    const BYTE x0 = c.VX[X] % display_width;
+    const BYTE y0 = c.VX[Y] % display_height;
+    c.VX[0xF] = xor_sprite(c.display, &c.mem[c.I], N, x0, y0);
+    // Rows y0 .. y0 + N - 1, wrapping at the bottom
+    c.dirty_rows |= std::rotl(static_cast<uint32_t>((uint64_t{1} << N) - 1), y0);
+}
+
+using EncodeFn = WORD (*)(WORD X, WORD Y, WORD N, WORD NN, WORD NNN);
+
 struct OpInfo {
     Op id;
     WORD mask;
@@ -149,111 +322,115 @@ struct OpInfo {
     EncodeFn encode;
 };
 
-inline auto exec_cls(Chip8 &c, WORD) -> void { clear_display(c); }
-inline auto exec_ret(Chip8 &c, WORD) -> void {
+inline auto exec_cls(Chip8 &c, Instr) -> void { clear_display(c); }
+inline auto exec_ret(Chip8 &c, Instr) -> void {
     if (c.stack_pointer < 0) PANIC("Stack under-flow");
-    c.PC = c.stack[c.stack_pointer--];
+    c.PC = c.stack[static_cast<size_t>(c.stack_pointer--)];
 }
-inline auto exec_jmp(Chip8 &c, WORD w) -> void { c.PC = field_NNN(w); }
-inline auto exec_call_subroutine(Chip8 &c, WORD w) -> void {
-    if (++c.stack_pointer >= c.stack.size()) PANIC("Stack overflow");
-    c.stack[++c.stack_pointer] = c.PC;
-    c.PC = field_NNN(w);
+inline auto exec_jmp(Chip8 &c, Instr i) -> void { c.PC = i.NNN; }
+inline auto exec_call_subroutine(Chip8 &c, Instr i) -> void {
+    if (c.stack_pointer + 1 >= static_cast<int>(c.stack.size())) PANIC("Stack overflow");
+    c.stack[static_cast<size_t>(++c.stack_pointer)] = c.PC;
+    c.PC = i.NNN;
 }
-inline auto exec_skip_eq(Chip8 &c, WORD w) -> void {
-    if (c.VX[field_X(w)] == field_NN(w)) c.PC += 2;
+inline auto exec_skip_eq(Chip8 &c, Instr i) -> void {
+    if (c.VX[i.X] == i.NN) c.PC += 2;
 }
-inline auto exec_skip_not_eq(Chip8 &c, WORD w) -> void {
-    if (c.VX[field_X(w)] != field_NN(w)) c.PC += 2;
+inline auto exec_skip_not_eq(Chip8 &c, Instr i) -> void {
+    if (c.VX[i.X] != i.NN) c.PC += 2;
 }
-inline auto exec_skip_eq_register(Chip8 &c, WORD w) -> void {
-    if (c.VX[field_X(w)] == c.VX[field_Y(w)]) c.PC += 2;
+inline auto exec_skip_eq_register(Chip8 &c, Instr i) -> void {
+    if (c.VX[i.X] == c.VX[i.Y]) c.PC += 2;
 }
-inline auto exec_set_register(Chip8 &c, WORD w) -> void { c.VX[field_X(w)] = field_NN(w); }
-inline auto exec_add_to_register(Chip8 &c, WORD w) -> void {
+inline auto exec_set_register(Chip8 &c, Instr i) -> void { c.VX[i.X] = i.NN; }
+inline auto exec_add_to_register(Chip8 &c, Instr i) -> void {
     // No carry flag is correct behaviour
-    c.VX[field_X(w)] += field_NN(w);
-}
-inline auto exec_copy_register(Chip8 &c, WORD w) -> void { c.VX[field_X(w)] = c.VX[field_Y(w)]; }
-inline auto exec_math_or(Chip8 &c, WORD w) -> void { c.VX[field_X(w)] |= c.VX[field_Y(w)]; }
-inline auto exec_math_and(Chip8 &c, WORD w) -> void { c.VX[field_X(w)] &= c.VX[field_Y(w)]; }
-inline auto exec_math_xor(Chip8 &c, WORD w) -> void { c.VX[field_X(w)] ^= c.VX[field_Y(w)]; }
-inline auto exec_math_add(Chip8 &c, WORD w) -> void {
-    WORD tmp = c.VX[field_X(w)];
-    tmp += c.VX[field_Y(w)];
+    c.VX[i.X] += i.NN;
+}
+inline auto exec_copy_register(Chip8 &c, Instr i) -> void { c.VX[i.X] = c.VX[i.Y]; }
+inline auto exec_math_or(Chip8 &c, Instr i) -> void { c.VX[i.X] |= c.VX[i.Y]; }
+inline auto exec_math_and(Chip8 &c, Instr i) -> void { c.VX[i.X] &= c.VX[i.Y]; }
+inline auto exec_math_xor(Chip8 &c, Instr i) -> void { c.VX[i.X] ^= c.VX[i.Y]; }
+inline auto exec_math_add(Chip8 &c, Instr i) -> void {
+    WORD tmp = c.VX[i.X];
+    tmp += c.VX[i.Y];
     c.VX[0xF] = (tmp > 0xFF) ? 1 : 0; // Carry Flag bit
-    c.VX[field_X(w)] = static_cast<BYTE>(tmp);
+    c.VX[i.X] = static_cast<BYTE>(tmp);
 }
-inline auto exec_math_sub(Chip8 &c, WORD w) -> void {
-    BYTE X = field_X(w);
-    BYTE Y = field_Y(w);
-    BYTE VX = c.VX[X];
-    BYTE VY = c.VX[Y];
+inline auto exec_math_sub(Chip8 &c, Instr i) -> void {
+    BYTE VX = c.VX[i.X];
+    BYTE VY = c.VX[i.Y];
     c.VX[0xF] = (VX >= VY) ? 1 : 0; // If NOT underflowing we set flag
-    c.VX[X] = VX - VY;
+    c.VX[i.X] = VX - VY;
 }
-inline auto exec_shr(Chip8 &c, WORD w) -> void {
-    BYTE X = field_X(w);
-    BYTE VX = c.VX[X];
+inline auto exec_shr(Chip8 &c, Instr i) -> void {
+    BYTE VX = c.VX[i.X];
     if (c.config.legacy_shift) {
-        VX = c.VX[field_Y(w)];
-        c.VX[X] = VX;
+        VX = c.VX[i.Y];
+        c.VX[i.X] = VX;
     }
     c.VX[0xF] = VX & 1;
-    c.VX[X] = VX >> 1;
+    c.VX[i.X] = VX >> 1;
 }
-inline auto exec_subn(Chip8 &c, WORD w) -> void {
-    BYTE X = field_X(w);
-    BYTE Y = field_Y(w);
-    BYTE VX = c.VX[X];
-    BYTE VY = c.VX[Y];
+inline auto exec_subn(Chip8 &c, Instr i) -> void {
+    BYTE VX = c.VX[i.X];
+    BYTE VY = c.VX[i.Y];
     c.VX[0xF] = (VY >= VX) ? 1 : 0; // If NOT underflowing we set flag
-    c.VX[X] = VY - VX;
+    c.VX[i.X] = VY - VX;
 }
-inline auto exec_shl(Chip8 &c, WORD w) -> void {
-    BYTE X = field_X(w);
-    BYTE VX = c.VX[X];
+inline auto exec_shl(Chip8 &c, Instr i) -> void {
+    BYTE VX = c.VX[i.X];
     if (c.config.legacy_shift) {
-        VX = c.VX[field_Y(w)];
-        c.VX[X] = VX;
+        VX = c.VX[i.Y];
+        c.VX[i.X] = VX;
     }
     c.VX[0xF] = (VX >> 7) & 1;
-    c.VX[X] = VX << 1;
+    c.VX[i.X] = VX << 1;
+}
+inline auto exec_skip_not_eq_register(Chip8 &c, Instr i) -> void {
+    if (c.VX[i.X] != c.VX[i.Y]) c.PC += 2;
 }
-inline auto exec_skip_not_eq_register(Chip8 &c, WORD w) -> void {
-    if (c.VX[field_X(w)] != c.VX[field_Y(w)]) c.PC += 2;
+inline auto exec_set_i(Chip8 &c, Instr i) -> void { c.I = i.NNN; }
+inline auto exec_jmp_offset(Chip8 &c, Instr i) -> void { c.PC = i.NNN + c.VX[0x0]; }
+/* splitmix64, the whole generator is one word of machine state so it can be saved and restored. */
+inline auto random_byte(Chip8 &c) -> BYTE {
+    uint64_t z = (c.rng_state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    z ^= z >> 31;
+    return static_cast<BYTE>(z >> 56);
 }
-inline auto exec_set_i(Chip8 &c, WORD w) -> void { c.I = field_NNN(w); }
-inline auto exec_jmp_offset(Chip8 &c, WORD w) -> void { c.PC = field_NNN(w) + c.VX[0x0]; }
-inline auto exec_get_random(Chip8 &c, WORD w) -> void {
-    BYTE rand = get_random_byte();
-    c.VX[field_X(w)] = rand & field_NN(w);
+/* Makes every RND that follows reproducible, e.g. for movies and regression runs. */
+inline auto seed_random(Chip8 &c, uint64_t seed) -> void { c.rng_state = seed; }
+inline auto exec_get_random(Chip8 &c, Instr i) -> void {
+    BYTE rand = random_byte(c);
+    c.VX[i.X] = rand & i.NN;
 }
-inline auto exec_draw(Chip8 &c, WORD w) -> void { draw_sprite(c, w); }
-inline auto exec_skip_pressed(Chip8 &c, WORD w) -> void {
-    BYTE key_target = c.VX[field_X(w)];
+inline auto exec_draw(Chip8 &c, Instr i) -> void { draw_sprite(c, i.X, i.Y, i.N); }
+inline auto exec_skip_pressed(Chip8 &c, Instr i) -> void {
+    BYTE key_target = c.VX[i.X];
     if (key_target > 0xF) PANIC("In exec_skip_pressed, VX value must be <= 0xF!");
     if (c.keypad[key_target]) c.PC += 2;
 }
-inline auto exec_skip_not_pressed(Chip8 &c, WORD w) -> void {
-    BYTE key_target = c.VX[field_X(w)];
+inline auto exec_skip_not_pressed(Chip8 &c, Instr i) -> void {
+    BYTE key_target = c.VX[i.X];
     if (key_target > 0xF) PANIC("In exec_skip_not_pressed, VX value must be <= 0xF!");
     if (!c.keypad[key_target]) c.PC += 2;
 }
-inline auto exec_load_delay(Chip8 &c, WORD w) -> void { c.VX[field_X(w)] = c.delay_timer; }
-inline auto exec_wait_key(Chip8 &c, WORD w) -> void {
-    for (size_t i = 0; i <= 0xF; i++) {
-        if (c.just_pressed[i]) {
-            c.VX[field_X(w)] = i;
+inline auto exec_load_delay(Chip8 &c, Instr i) -> void { c.VX[i.X] = c.delay_timer; }
+inline auto exec_wait_key(Chip8 &c, Instr i) -> void {
+    for (size_t k = 0; k <= 0xF; k++) {
+        if (c.just_pressed[k]) {
+            c.VX[i.X] = static_cast<BYTE>(k);
             return;
         }
     }
     c.PC -= 2; // Repeat
 }
-inline auto exec_set_delay(Chip8 &c, WORD w) -> void { c.delay_timer = c.VX[field_X(w)]; }
-inline auto exec_set_sound(Chip8 &c, WORD w) -> void { c.sound_timer = c.VX[field_X(w)]; }
-inline auto exec_add_i(Chip8 &c, WORD w) -> void {
-    BYTE VX = c.VX[field_X(w)];
+inline auto exec_set_delay(Chip8 &c, Instr i) -> void { c.delay_timer = c.VX[i.X]; }
+inline auto exec_set_sound(Chip8 &c, Instr i) -> void { c.sound_timer = c.VX[i.X]; }
+inline auto exec_add_i(Chip8 &c, Instr i) -> void {
+    BYTE VX = c.VX[i.X];
     WORD tmp = c.I + VX;
 
     if (c.config.legacy_add_index) {
@@ -265,35 +442,38 @@ inline auto exec_add_i(Chip8 &c, WORD w) -> void {
 
     c.I = tmp & 0x0FFF; // Avoid out of bounds address access
 }
-inline auto exec_set_i_sprite(Chip8 &c, WORD w) -> void {
+inline auto exec_set_i_sprite(Chip8 &c, Instr i) -> void {
     constexpr WORD bytes_per_char = 5;
-    BYTE digit = c.VX[field_X(w)] & 0x0F;
-    c.I = CONSTANTS::rom_font_start + digit * bytes_per_char;
+    BYTE digit = c.VX[i.X] & 0x0F;
+    c.I = static_cast<WORD>(CONSTANTS::rom_font_start + digit * bytes_per_char);
 }
-inline auto exec_store_bcd(Chip8 &c, WORD w) -> void {
-    if (c.I + 2 >= c.mem.size()) PANIC("I overflow");
-    BYTE VX = c.VX[field_X(w)];
+inline auto exec_store_bcd(Chip8 &c, Instr i) -> void {
+    if (c.I + 2u >= c.mem.size()) PANIC("I overflow");
+    BYTE VX = c.VX[i.X];
     c.mem[c.I] = VX / 100;
     c.mem[c.I + 1] = (VX / 10) % 10;
     c.mem[c.I + 2] = VX % 10;
+    invalidate_decoded(c, c.I, 3);
 }
-inline auto exec_dump_registers(Chip8 &c, WORD w) -> void {
-    BYTE X = field_X(w);
-    if (c.I + X + 1 >= c.mem.size()) PANIC("I overflow");
-    for (size_t i = 0; i <= X; ++i) {
-        c.mem[c.I + i] = c.VX[i];
+inline auto exec_dump_registers(Chip8 &c, Instr i) -> void {
+    BYTE X = i.X;
+    if (c.I + X + 1u >= c.mem.size()) PANIC("I overflow");
+    for (size_t k = 0; k <= X; ++k) {
+        c.mem[c.I + k] = c.VX[k];
     }
-    if (c.config.legacy_memory_dump) c.I += X + 1;
+    invalidate_decoded(c, c.I, X + 1u);
+    if (c.config.legacy_memory_dump) c.I = static_cast<WORD>(c.I + X + 1);
 }
-inline auto exec_fill_registers(Chip8 &c, WORD w) -> void {
-    BYTE X = field_X(w);
-    if (c.I + X + 1 >= c.mem.size()) PANIC("I overflow");
-    for (size_t i = 0; i <= X; ++i) {
-        c.VX[i] = c.mem[c.I + i];
+inline auto exec_fill_registers(Chip8 &c, Instr i) -> void {
+    BYTE X = i.X;
+    if (c.I + X + 1u >= c.mem.size()) PANIC("I overflow");
+    for (size_t k = 0; k <= X; ++k) {
+        c.VX[k] = c.mem[c.I + k];
     }
-    if (c.config.legacy_memory_dump) c.I += X + 1;
+    if (c.config.legacy_memory_dump) c.I = static_cast<WORD>(c.I + X + 1);
 }
-inline auto exec_sys(Chip8 &c, WORD w) -> void { PANIC_UNDEFINED(w); }
+inline auto exec_sys(Chip8 &, Instr i) -> void { PANIC_UNDEFINED(i.w); }
+inline auto exec_not_implemented(Chip8 &, Instr i) -> void { PANIC_NOT_IMPLEMENTED(i.w); }
 
 // clang-format off
 inline auto encode_cls                 (WORD,WORD,WORD,WORD,WORD         ) -> WORD { return 0x00E0; }
@@ -390,7 +570,6 @@ namespace detail {
     template <size_t N>
     constexpr bool decode_table_has_no_conflicts(const std::array<OpInfo, N>& ops) {
         for (size_t i = 0; i < N; ++i) {
-            const auto& a = ops[i];
             for (size_t j = i + 1; j < N; ++j) {
                 if (ops[i].id == Op::sys || ops[j].id == Op::sys) continue;
 
@@ -406,6 +585,38 @@ namespace detail {
 static_assert(detail::are_unique_mnemonics(OPS), "Duplicate 3-letter opcodes in OPS");
 static_assert(detail::decode_table_has_no_conflicts(OPS), "Decode table has overlapping entries");
 
+namespace detail {
+    inline constexpr BYTE no_op = 0xFF;
+    static_assert(OPS.size() < no_op, "OPS index must fit into a BYTE");
+
+    /*
+    Maps every possible WORD to the index of the first matching entry in OPS (or no_op).
+
+    Instead of scanning OPS for all 64K words we enumerate, per entry, exactly the words
+    matching its pattern (walking the subsets of the don't-care bits). Entries are visited
+    back to front so that earlier OPS entries win, which keeps the first-match semantics
+    of the linear scan (relevant for SYS vs CLS/RET).
+    */
+    template <size_t N>
+    constexpr auto build_decode_table(const std::array<OpInfo, N>& ops) -> std::array<BYTE, 0x10000> {
+        std::array<BYTE, 0x10000> table{};
+        for (auto& entry : table) entry = no_op;
+        for (size_t i = N; i-- > 0;) {
+            const WORD free_bits = static_cast<WORD>(~ops[i].mask);
+            WORD sub = 0;
+            do {
+                table[ops[i].pattern | sub] = static_cast<BYTE>(i);
+                sub = static_cast<WORD>((sub - free_bits) & free_bits);
+            } while (sub != 0);
+        }
+        return table;
+    }
+}
+inline constexpr std::array<BYTE, 0x10000> DECODE_TABLE = detail::build_decode_table(OPS);
+static_assert(OPS[DECODE_TABLE[0xF065]].id == Op::fill_registers, "Decode table is out of sync with OPS");
+static_assert(OPS[DECODE_TABLE[0x00EE]].id == Op::ret, "Decode table must prefer RET over SYS");
+static_assert(DECODE_TABLE[0x5001] == detail::no_op, "Decode table must leave undefined words unmapped");
+
 
 auto find_op(Op id) -> const OpInfo * {
     for (const auto &op : OPS)
@@ -416,9 +627,8 @@ auto find_op(Op id) -> const OpInfo * {
 // clang-format on
 
 inline auto decode(WORD opcode) -> OpInfo const * {
-    for (auto const &op : OPS)
-        if ((opcode & op.mask) == op.pattern) return &op;
-    return nullptr;
+    const BYTE idx = DECODE_TABLE[opcode];
+    return (idx != detail::no_op) ? &OPS[idx] : nullptr;
 }
 
 inline auto human_readable_fmt(WORD opcode) -> std::optional<std::string> {
@@ -568,17 +778,201 @@ inline auto disassemble(WORD w) -> std::string {
     return s;
 }
 
+/*
+Superinstructions: common idioms that the table engine can execute as one handler when
+`Chip8::fuse_superinstructions` is set. Matched on the decoded Op sequence, the operands are free.
+*/
+struct FusionPattern {
+    std::array<Op, max_fused_length> ops;
+    size_t length;
+};
+inline constexpr std::array<FusionPattern, 4> FUSIONS = {{
+    {{Op::load_delay, Op::skip_eq, Op::jmp}, 3},      // FX07 3X00 1NNN: delay timer busy-wait
+    {{Op::add_to_register, Op::skip_eq, Op::jmp}, 3}, // 7XNN 3XNN 1NNN: counting loop
+    {{Op::set_register, Op::set_register}, 2},        // 6XNN 6YNN
+    {{Op::set_i, Op::draw}, 2},                       // ANNN DXYN
+}};
+
+inline auto op_at(const Chip8 &c, size_t addr) -> std::optional<Op> {
+    if (addr + 1 >= c.mem.size()) return std::nullopt;
+    const auto *info = decode((c.mem[addr] << 8) | c.mem[addr + 1]);
+    return info ? std::optional<Op>(info->id) : std::nullopt;
+}
+
+/* Returns 1 + the index of the first pattern in FUSIONS starting at `addr`, or 0. */
+inline auto match_fusion(const Chip8 &c, WORD addr) -> BYTE {
+    for (size_t f = 0; f < FUSIONS.size(); ++f) {
+        const auto &pattern = FUSIONS[f];
+        bool matches = true;
+        for (size_t k = 0; k < pattern.length && matches; ++k) {
+            matches = op_at(c, addr + 2 * k) == pattern.ops[k];
+        }
+        if (matches) return static_cast<BYTE>(f + 1);
+    }
+    return 0;
+}
+
+/* Returns the cached decode for the instruction at `addr`, decoding it on a miss. */
+inline auto fetch_decoded(Chip8 &c, WORD addr) -> const DecodedInstr & {
+    DecodedInstr &d = c.decoded[addr];
+    if (!d.exec) [[unlikely]] {
+        const WORD w = (c.mem[addr] << 8) | c.mem[addr + 1];
+        const auto *info = decode(w);
+        d.ins = make_instr(w);
+        d.exec = info ? info->exec : exec_not_implemented;
+        d.id = info ? info->id : Op::sys;
+        d.fusion = info ? match_fusion(c, addr) : 0;
+    }
+    return d;
+}
+
+#if CHIP8_PROFILE
+/* Counts the instruction `d` at `pc`, about to be executed. */
+inline auto profile_instruction(Profile &p, WORD pc, const DecodedInstr &d) -> void {
+    ++p.per_op[static_cast<size_t>(d.id)];
+    ++p.per_pc[pc];
+    if (pc != p.next_pc) ++p.per_block[pc];
+    p.next_pc = static_cast<WORD>(pc + 2);
+    ++p.calls[p.current].count;
+    if (d.id == Op::call_subroutine) {
+        const uint32_t key = p.current << 16 | d.ins.NNN;
+        const auto [it, added] = p.children.try_emplace(key, static_cast<uint32_t>(p.calls.size()));
+        if (added) p.calls.push_back(Profile::CallNode{d.ins.NNN, p.current, 0});
+        p.current = it->second;
+    } else if (d.id == Op::ret) {
+        p.current = p.calls[p.current].parent; // The root is its own parent
+    }
+}
+#endif
+
 inline auto fetch_and_execute(Chip8 &c) -> void {
     if (c.PC > c.mem.size() - 2) PANIC("PC out of bounds");
     c.iteration_counter += 1;
-    WORD w = (c.mem[c.PC] << 8) | c.mem[c.PC + 1];
+    // Copy, the handler may write to memory and thereby invalidate the cache entry
+    const DecodedInstr d = fetch_decoded(c, c.PC);
+#if CHIP8_PROFILE
+    if (c.profiling) [[unlikely]] profile_instruction(c.profile, c.PC, d);
+#endif
     c.PC += 2;
+    d.exec(c, d.ins);
+}
 
-    if (auto info = decode(w)) {
-        info->exec(c, w);
-        return;
+/*
+Idle loops spin without any observable effect until the next timer tick or key event, and neither
+can happen inside a single `step` (timers and input are only updated between steps). So once PC
+sits at one, the rest of the budget can be accounted for analytically instead of executed:
+- FX0A with no key in `just_pressed` rewinds PC forever.
+- FX07 / 3X00 / 1NNN jumping back to the FX07 while the delay timer != 00.
+*/
+inline auto is_idle_candidate(Op id) -> bool { return id == Op::wait_key || id == Op::load_delay; }
+
+/* Returns how many of the `remaining` instructions were fast-forwarded, 0 if PC is not at an idle loop. */
+inline auto fast_forward_idle(Chip8 &c, const DecodedInstr &d, size_t remaining) -> size_t {
+    size_t skipped = 0;
+    if (d.id == Op::wait_key) {
+        for (bool pressed : c.just_pressed) {
+            if (pressed) return 0;
+        }
+        skipped = remaining;
+    } else if (d.id == Op::load_delay && d.fusion != 0) { // FUSIONS[0] is the only one starting with FX07
+        const Instr skip = fetch_decoded(c, c.PC + 2).ins;
+        const Instr jmp = fetch_decoded(c, c.PC + 4).ins;
+        if (skip.X != d.ins.X || jmp.NNN != c.PC || c.delay_timer == skip.NN) return 0;
+        skipped = remaining - remaining % 3; // The leftover partial iteration is executed normally
+        if (skipped == 0) return 0;
+        c.VX[d.ins.X] = c.delay_timer;
+    }
+    c.iteration_counter += skipped;
+    c.instructions_skipped += skipped;
+    return skipped;
+}
+
+/* Same end state as calling fetch_and_execute `num_iterations` times, but skips idle loops. */
+inline auto run_table(Chip8 &c, size_t num_iterations) -> void {
+    size_t remaining = num_iterations;
+    while (remaining > 0) {
+        if (c.PC > c.mem.size() - 2) PANIC("PC out of bounds");
+        const DecodedInstr d = fetch_decoded(c, c.PC);
+        if (is_idle_candidate(d.id)) [[unlikely]] {
+            if (const size_t skipped = fast_forward_idle(c, d, remaining)) {
+                remaining -= skipped;
+                continue;
+            }
+        }
+        c.iteration_counter += 1;
+        c.PC += 2;
+        d.exec(c, d.ins);
+        remaining -= 1;
+    }
+}
+
+/*
+Fused handlers, each is entered with PC pointing at its first instruction and leaves PC and
+iteration_counter exactly as executing the sequence one by one would. Returns the number of
+instructions executed, which is less than the pattern length if a skip jumps over the rest.
+*/
+using FusedFn = size_t (*)(Chip8 &, Instr);
+
+template <ExecFn Exec>
+inline auto fused_skip_eq_loop(Chip8 &c, Instr a) -> size_t {
+    const Instr skip = fetch_decoded(c, c.PC + 2).ins;
+    const Instr jmp = fetch_decoded(c, c.PC + 4).ins;
+    Exec(c, a);
+    c.iteration_counter += 2;
+    if (c.VX[skip.X] == skip.NN) {
+        c.PC += 6;
+        return 2;
+    }
+    c.iteration_counter += 1;
+    c.PC = jmp.NNN;
+    return 3;
+}
+inline auto fused_set_set(Chip8 &c, Instr a) -> size_t {
+    const Instr b = fetch_decoded(c, c.PC + 2).ins;
+    c.VX[a.X] = a.NN;
+    c.VX[b.X] = b.NN;
+    c.iteration_counter += 2;
+    c.PC += 4;
+    return 2;
+}
+inline auto fused_set_i_draw(Chip8 &c, Instr a) -> size_t {
+    const Instr b = fetch_decoded(c, c.PC + 2).ins;
+    c.I = a.NNN;
+    c.iteration_counter += 2;
+    c.PC += 4;
+    draw_sprite(c, b.X, b.Y, b.N);
+    return 2;
+}
+
+// Parallel to FUSIONS
+inline constexpr std::array<FusedFn, FUSIONS.size()> FUSED_HANDLERS = {
+    fused_skip_eq_loop<exec_load_delay>,
+    fused_skip_eq_loop<exec_add_to_register>,
+    fused_set_set,
+    fused_set_i_draw,
+};
+
+/* Same semantics as calling fetch_and_execute `num_iterations` times, but runs FUSIONS as one handler. */
+inline auto run_fused(Chip8 &c, size_t num_iterations) -> void {
+    size_t remaining = num_iterations;
+    while (remaining > 0) {
+        if (c.PC > c.mem.size() - 2) PANIC("PC out of bounds");
+        const DecodedInstr d = fetch_decoded(c, c.PC);
+        if (is_idle_candidate(d.id)) [[unlikely]] {
+            if (const size_t skipped = fast_forward_idle(c, d, remaining)) {
+                remaining -= skipped;
+                continue;
+            }
+        }
+        if (d.fusion && FUSIONS[d.fusion - 1].length <= remaining) {
+            remaining -= FUSED_HANDLERS[d.fusion - 1](c, d.ins);
+            continue;
+        }
+        c.iteration_counter += 1;
+        c.PC += 2;
+        d.exec(c, d.ins);
+        remaining -= 1;
     }
-    PANIC_NOT_IMPLEMENTED(w);
 }
 
 inline auto format_instruction_line(WORD pc, WORD instr) -> std::string {
@@ -595,14 +989,20 @@ inline auto format_instruction_line(WORD pc, WORD instr) -> std::string {
         return std::format("{:04X}: {}", pc, disasm);
 }
 
+/* A logged instruction, disassembled by the logger thread rather than the one executing it. */
+struct InstructionLine {
+    WORD pc;
+    WORD instr;
+};
+
 inline auto log_current_operation(const Chip8 &c) -> void {
-    WORD w = (c.mem[c.PC] << 8) | c.mem[c.PC + 1];
-    LOG_INFO("{}", format_instruction_line(c.PC, w));
+    const WORD w = static_cast<WORD>(c.mem[c.PC] << 8 | c.mem[c.PC + 1]);
+    LOG_DEBUG("{}", InstructionLine{c.PC, w});
 }
 
 inline auto dump_memory(Chip8 &c) {
     std::ofstream f("memory.bin", std::ios::binary);
-    f.write(reinterpret_cast<char const *>(c.mem.data()), c.mem.size());
+    f.write(reinterpret_cast<char const *>(c.mem.data()), static_cast<std::streamsize>(c.mem.size()));
 }
 
 inline auto load_ch8(const std::filesystem::path &filepath) -> std::vector<WORD> {
@@ -631,12 +1031,13 @@ inline auto load_ch8(const std::filesystem::path &filepath) -> std::vector<WORD>
 inline auto write_program_to_memory(Chip8 &c, const std::vector<WORD> data) -> void {
     WORD addr = CONSTANTS::rom_program_start;
     for (WORD instr : data) {
-        if (addr + 1 >= c.mem.size()) {
+        if (addr + 1u >= c.mem.size()) {
             PANIC("Instruction write exceeds memory bound!");
         }
         c.mem[addr++] = static_cast<BYTE>((instr >> 8) & 0xFF);
         c.mem[addr++] = static_cast<BYTE>(instr & 0xFF);
     }
+    invalidate_decoded(c, CONSTANTS::rom_program_start, addr - CONSTANTS::rom_program_start);
 }
 
 inline auto load_program_from_file(Chip8 &c, const std::filesystem::path &filepath) -> void {
@@ -650,35 +1051,164 @@ inline auto initialise(Chip8 &c) -> void {
             c.mem[loc] = font;
             ++loc;
         }
+        invalidate_decoded(c, CONSTANTS::rom_font_start, CONSTANTS::fontdata.size());
     } // Font data
     c.PC = CONSTANTS::rom_program_start;
     c.last_timer_update = std::chrono::steady_clock::now();
+    std::random_device rd;
+    seed_random(c, (static_cast<uint64_t>(rd()) << 32) | rd());
+}
+
+inline auto tick_timers(Chip8 &c, size_t ticks = 1) -> void {
+    const BYTE ticks_u8 = static_cast<BYTE>(std::min<size_t>(ticks, 0xFF));
+    c.delay_timer = (c.delay_timer > ticks_u8) ? c.delay_timer - ticks_u8 : 0;
+    c.sound_timer = (c.sound_timer > ticks_u8) ? c.sound_timer - ticks_u8 : 0;
+}
+
+/*
+Input and frame boundaries, the only ways the outside world changes a running machine. Hosts must go
+through these so a movie (chip8_movie.hpp) can replay them exactly.
+*/
+inline auto press_key(Chip8 &c, BYTE key) -> void {
+    if (!c.keypad[key]) c.just_pressed[key] = true;
+    c.keypad[key] = true;
+}
+inline auto release_key(Chip8 &c, BYTE key) -> void { c.keypad[key] = false; }
+/* Ends an emulated 60Hz frame: host-driven timers tick and a press stays visible to FX0A for one frame only. */
+inline auto end_frame(Chip8 &c) -> void {
+    if (c.timer_mode == TimerMode::host) tick_timers(c);
+    c.just_pressed.fill(false);
 }
 
+/* Ticks the timers at 60Hz wall-clock time, does nothing outside TimerMode::realtime. */
 inline auto update_timers(Chip8 &c) -> void {
     using namespace std::chrono;
+    if (c.timer_mode != TimerMode::realtime) return;
 
     auto current_time = steady_clock::now();
     auto time_passed = current_time - c.last_timer_update;
 
     auto ticks = time_passed / CONSTANTS::timer_update_delay;
     if (ticks > 0) {
-        BYTE ticks_u8 = static_cast<uint16_t>(ticks);
+        tick_timers(c, static_cast<size_t>(ticks));
+        c.last_timer_update += CONSTANTS::timer_update_delay * ticks;
+    }
+}
 
-        c.delay_timer = (c.delay_timer > ticks_u8) ? c.delay_timer - ticks_u8 : 0;
-        c.sound_timer = (c.sound_timer > ticks_u8) ? c.sound_timer - ticks_u8 : 0;
+/*
+Same semantics as calling fetch_and_execute `num_iterations` times, but dispatches via a switch
+so the compiler can inline every handler into this one function instead of calling through ExecFn.
+*/
+inline auto run_switched(Chip8 &c, size_t num_iterations) -> void {
+    size_t remaining = num_iterations;
+    while (remaining > 0) {
+        if (c.PC > c.mem.size() - 2) PANIC("PC out of bounds");
+        const DecodedInstr d = fetch_decoded(c, c.PC);
+        if (is_idle_candidate(d.id)) [[unlikely]] {
+            if (const size_t skipped = fast_forward_idle(c, d, remaining)) {
+                remaining -= skipped;
+                continue;
+            }
+        }
+        c.iteration_counter += 1;
+        c.PC += 2;
+        remaining -= 1;
 
-        c.last_timer_update += CONSTANTS::timer_update_delay * ticks;
-        Audio::updateBeep(c.sound_timer > 0);
+        const Instr i = d.ins;
+        switch (d.id) {
+        // clang-format off
+        case Op::cls:                  exec_cls(c, i);                  break;
+        case Op::ret:                  exec_ret(c, i);                  break;
+        case Op::jmp:                  exec_jmp(c, i);                  break;
+        case Op::call_subroutine:      exec_call_subroutine(c, i);      break;
+        case Op::skip_eq:              exec_skip_eq(c, i);              break;
+        case Op::skip_not_eq:          exec_skip_not_eq(c, i);          break;
+        case Op::skip_eq_register:     exec_skip_eq_register(c, i);     break;
+        case Op::set_register:         exec_set_register(c, i);         break;
+        case Op::add_to_register:      exec_add_to_register(c, i);      break;
+        case Op::copy_register:        exec_copy_register(c, i);        break;
+        case Op::math_or:              exec_math_or(c, i);              break;
+        case Op::math_and:             exec_math_and(c, i);             break;
+        case Op::math_xor:             exec_math_xor(c, i);             break;
+        case Op::math_add:             exec_math_add(c, i);             break;
+        case Op::math_sub:             exec_math_sub(c, i);             break;
+        case Op::shr:                  exec_shr(c, i);                  break;
+        case Op::subn:                 exec_subn(c, i);                 break;
+        case Op::shl:                  exec_shl(c, i);                  break;
+        case Op::skip_not_eq_register: exec_skip_not_eq_register(c, i); break;
+        case Op::set_i:                exec_set_i(c, i);                break;
+        case Op::jmp_offset:           exec_jmp_offset(c, i);           break;
+        case Op::get_random:           exec_get_random(c, i);           break;
+        case Op::draw:                 exec_draw(c, i);                 break;
+        case Op::skip_pressed:         exec_skip_pressed(c, i);         break;
+        case Op::skip_not_pressed:     exec_skip_not_pressed(c, i);     break;
+        case Op::load_delay:           exec_load_delay(c, i);           break;
+        case Op::wait_key:             exec_wait_key(c, i);             break;
+        case Op::set_delay:            exec_set_delay(c, i);            break;
+        case Op::set_sound:            exec_set_sound(c, i);            break;
+        case Op::add_i:                exec_add_i(c, i);                break;
+        case Op::set_i_sprite:         exec_set_i_sprite(c, i);         break;
+        case Op::store_bcd:            exec_store_bcd(c, i);            break;
+        case Op::dump_registers:       exec_dump_registers(c, i);       break;
+        case Op::fill_registers:       exec_fill_registers(c, i);       break;
+        // SYS and undecodable words both panic, no point in inlining those
+        case Op::sys:                  d.exec(c, i);                    break;
+        // clang-format on
+        }
+    }
+}
+
+// Defined in chip8_jit.hpp
+inline auto run_jit(Chip8 &c, size_t num_iterations) -> void;
+
+inline auto run_engine(Chip8 &c, size_t num_iterations) -> void {
+#if CHIP8_PROFILE
+    if (c.profiling) { // One by one, so every instruction is counted where it executes, idle loops too
+        for (size_t k = 0; k < num_iterations; ++k) fetch_and_execute(c);
+        return;
+    }
+#endif
+    switch (c.dispatch) {
+    case Dispatch::table:
+        if (c.fuse_superinstructions) {
+            run_fused(c, num_iterations);
+        } else {
+            run_table(c, num_iterations);
+        }
+        break;
+    case Dispatch::switched:
+        run_switched(c, num_iterations);
+        break;
+    case Dispatch::jit:
+        run_jit(c, num_iterations);
+        break;
     }
 }
 
-/* Batches some predefined number of iterations and updates timer once */
+/* Runs `num_iterations` instructions on the selected engine, ticking the timers as timer_mode says. */
 inline auto step(Chip8 &c, size_t num_iterations) -> void {
     update_timers(c);
-    for (size_t i = 0; i < num_iterations; ++i) {
-        fetch_and_execute(c);
+    const uint64_t skipped_before = c.instructions_skipped;
+    const size_t budget = num_iterations;
+    if (c.timer_mode != TimerMode::instructions) {
+        run_engine(c, num_iterations);
+        c.idle = budget > 0 && c.instructions_skipped - skipped_before == budget;
+        return;
     }
+    // Split at tick boundaries, so neither an engine run nor an idle fast-forward spans a tick
+    const uint32_t per_tick = std::max<uint32_t>(c.instructions_per_tick, 1);
+    c.tick_phase = std::min(c.tick_phase, per_tick - 1); // instructions_per_tick may have been lowered
+    while (num_iterations > 0) {
+        const size_t chunk = std::min<size_t>(num_iterations, per_tick - c.tick_phase);
+        run_engine(c, chunk);
+        num_iterations -= chunk;
+        c.tick_phase += static_cast<uint32_t>(chunk);
+        if (c.tick_phase == per_tick) {
+            c.tick_phase = 0;
+            tick_timers(c);
+        }
+    }
+    c.idle = budget > 0 && c.instructions_skipped - skipped_before == budget;
 }
 inline auto step(Chip8 &c) -> void {
     step(c, CONSTANTS::n_iter_per_frame);
@@ -725,4 +1255,13 @@ inline auto disassemble_rom_to_file(
     return *out_path;
 }
 
-} // namespace CHIP8
\ No newline at end of file
+} // namespace CHIP8
+
+template <>
+struct std::formatter<CHIP8::InstructionLine> : std::formatter<std::string_view> {
+    auto format(const CHIP8::InstructionLine &line, std::format_context &ctx) const {
+        return std::formatter<std::string_view>::format(CHIP8::format_instruction_line(line.pc, line.instr), ctx);
+    }
+};
+
+#include "chip8_jit.hpp"
@@ -0,0 +1,52 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/* The part of CONSTANTS the emulator core needs, kept free of glm so the core builds headless. */
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace CONSTANTS {
+using namespace std::chrono_literals;
+
+inline constexpr uint16_t rom_program_start = 0x200;
+inline constexpr uint16_t rom_font_start = 0x050;
+
+inline constexpr size_t n_iter_per_frame = 700;
+inline constexpr auto timer_update_delay = 16'666'667ns; // 1 second / 60 in nanoseconds
+inline constexpr double timer_frequency = 60.0;
+inline constexpr double default_instructions_per_second = 700.0;
+
+inline constexpr std::array<const char *, 7> fp_code_test_suite = {
+    "assets/code/1-chip8-logo.ch8",
+    "assets/code/2-ibm-logo.ch8",
+    "assets/code/3-corax+.ch8",
+    "assets/code/4-flags.ch8",
+    "assets/code/5-quirks.ch8",
+    "assets/code/6-keypad.ch8",
+    "assets/code/7-beep.ch8"};
+inline constexpr char const *fp_code_ibm_logo = "assets/code/IBM Logo.ch8";
+// https://github.com/stianeklund/chip8
+inline constexpr char const *fp_code_pong = "assets/code/PONG.ch8";
+
+inline constexpr std::array<uint8_t, 5 * 16> fontdata{
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+} // namespace CONSTANTS
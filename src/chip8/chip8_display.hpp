@@ -0,0 +1,124 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Framebuffer layout plus the routines operating on it (DXYN, CLS, equality).
+
+CLS and equality exist as scalar kernels and, on x86-64, as SSE2 and AVX2 kernels, the set used by
+the emulator is picked once at startup from the host CPU features, see `display_kernels`. DXYN is
+plain scalar code: it touches at most 15 rows, and building a full-height mask to XOR the whole
+display at once costs more than the handful of rows it saves branching on.
+*/
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#include "chip8_types.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define CHIP8_SIMD_X86 0
+#endif
+
+namespace CHIP8 {
+inline constexpr int display_width = 64;
+inline constexpr int display_height = 32;
+
+/* One bit per pixel, the most significant bit is x = 0. */
+using DisplayRow = uint64_t;
+static_assert(sizeof(DisplayRow) * 8 == display_width);
+using Display = std::array<DisplayRow, display_height>;
+
+/* One byte per pixel, the layout `display` used to have, for consumers that index [y][x]. */
+using ByteDisplay = std::array<std::array<PIXEL, display_width>, display_height>;
+
+/* Sprite byte placed at x = 0 and rotated into position so it wraps at the right edge. */
+inline auto sprite_row(BYTE bits, BYTE x0) -> DisplayRow {
+    return std::rotr(DisplayRow{bits} << (display_width - 8), x0);
+}
+
+/* XORs `n` sprite rows onto the display at (x0, y0) with wrap-around, returns the new VF. */
+inline auto xor_sprite(Display &display, const BYTE *sprite, BYTE n, BYTE x0, BYTE y0) -> BYTE {
+    DisplayRow collision = 0;
+    for (size_t row = 0; row < n; ++row) {
+        const DisplayRow bits = sprite_row(sprite[row], x0);
+        DisplayRow &dst = display[(y0 + row) % display.size()];
+        collision |= dst & bits;
+        dst ^= bits;
+    }
+    return collision ? 1 : 0;
+}
+
+struct DisplayKernels {
+    const char *name;
+    void (*clear)(Display &display);
+    bool (*equal)(const Display &a, const Display &b);
+};
+
+namespace KERNELS {
+    inline auto clear_scalar(Display &display) -> void { display.fill(0); }
+    inline auto equal_scalar(const Display &a, const Display &b) -> bool { return a == b; }
+
+    inline constexpr DisplayKernels scalar = {"scalar", clear_scalar, equal_scalar};
+
+#if CHIP8_SIMD_X86
+    inline auto clear_sse2(Display &display) -> void {
+        for (size_t row = 0; row < display.size(); row += 2) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(&display[row]), _mm_setzero_si128());
+        }
+    }
+    inline auto equal_sse2(const Display &a, const Display &b) -> bool {
+        __m128i diff = _mm_setzero_si128();
+        for (size_t row = 0; row < a.size(); row += 2) {
+            const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&a[row]));
+            const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&b[row]));
+            diff = _mm_or_si128(diff, _mm_xor_si128(va, vb));
+        }
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF;
+    }
+
+    inline constexpr DisplayKernels sse2 = {"sse2", clear_sse2, equal_sse2};
+
+    __attribute__((target("avx2"))) inline auto clear_avx2(Display &display) -> void {
+        for (size_t row = 0; row < display.size(); row += 4) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(&display[row]), _mm256_setzero_si256());
+        }
+    }
+    __attribute__((target("avx2"))) inline auto equal_avx2(const Display &a, const Display &b) -> bool {
+        __m256i diff = _mm256_setzero_si256();
+        for (size_t row = 0; row < a.size(); row += 4) {
+            const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&a[row]));
+            const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&b[row]));
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(va, vb));
+        }
+        return _mm256_testz_si256(diff, diff) != 0;
+    }
+
+    inline constexpr DisplayKernels avx2 = {"avx2", clear_avx2, equal_avx2};
+#endif
+
+    inline auto cpu_has_avx2() -> bool {
+#if CHIP8_SIMD_X86
+        __builtin_cpu_init(); // May run before the runtime initialised the feature bits
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    inline auto select() -> const DisplayKernels & {
+#if CHIP8_SIMD_X86
+        if (cpu_has_avx2()) return avx2;
+        return sse2; // Part of the x86-64 baseline
+#else
+        return scalar;
+#endif
+    }
+} // namespace KERNELS
+
+/* Chosen once at startup for the host CPU. */
+inline const DisplayKernels &display_kernels = KERNELS::select();
+} // namespace CHIP8
@@ -0,0 +1,469 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Dynamic recompiler for straight-line CHIP-8 code.
+
+A block starts at some PC and covers the following run of register/index arithmetic
+(6XNN, 7XNN, 8XY*, ANNN, FX1E, FX29). Everything else (jumps, skips, calls, DXYN, key, timer,
+memory and random ops) ends the block and is executed by the interpreter, as is every
+instruction on hosts other than x86-64 Linux/macOS.
+
+The V registers touched by a block live in host registers for its whole duration and are
+written back on exit together with I, PC and iteration_counter. Blocks are cached per PC and
+the whole cache is flushed whenever `Chip8::code_epoch` moves (self-modifying code), the quirk
+config changes or the machine owning it is moved. Copying a machine never copies its cache.
+*/
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "chip8.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CHIP8_JIT_AVAILABLE 1
+#include <sys/mman.h>
+#else
+#define CHIP8_JIT_AVAILABLE 0
+#endif
+
+namespace CHIP8::JIT {
+using BlockFn = void (*)(Chip8 *);
+
+struct Block {
+    BlockFn fn = nullptr;
+    WORD length = 0;       // Number of CHIP-8 instructions, 0 means interpret the instruction at this PC
+    bool compiled = false; // Whether we already tried, so non-compilable PCs are only inspected once
+};
+
+inline constexpr size_t max_block_length = 64;
+inline constexpr size_t arena_size = 1 << 20;
+
+#if CHIP8_JIT_AVAILABLE
+/* Fixed-size executable buffer, kept W^X by flipping protection around every append. */
+class CodeArena {
+public:
+    CodeArena() {
+        void *p = mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) PANIC("JIT: mmap of the code arena failed");
+        m_base = static_cast<BYTE *>(p);
+        protect(PROT_READ | PROT_EXEC);
+    }
+    ~CodeArena() { munmap(m_base, arena_size); }
+    CodeArena(const CodeArena &) = delete;
+    CodeArena &operator=(const CodeArena &) = delete;
+
+    /* Copies `code` into the arena, returns nullptr if it is full. */
+    auto append(const std::vector<BYTE> &code) -> BlockFn {
+        if (m_used + code.size() > arena_size) return nullptr;
+        protect(PROT_READ | PROT_WRITE);
+        BYTE *dst = m_base + m_used;
+        std::memcpy(dst, code.data(), code.size());
+        protect(PROT_READ | PROT_EXEC);
+        m_used += code.size();
+        return reinterpret_cast<BlockFn>(dst);
+    }
+    auto reset() -> void { m_used = 0; }
+
+private:
+    BYTE *m_base = nullptr;
+    size_t m_used = 0;
+
+    auto protect(int prot) -> void {
+        if (mprotect(m_base, arena_size, prot) != 0) PANIC("JIT: mprotect of the code arena failed");
+    }
+};
+
+/* Just enough of an x86-64 encoder for the blocks we emit, all arithmetic is 32-bit. */
+class Emitter {
+public:
+    enum Reg : BYTE { rax = 0, rcx = 1, rdx = 2, rsi = 6, rdi = 7, r8 = 8, r9 = 9, r10 = 10, r11 = 11 };
+    enum AluImm : BYTE { add_imm = 0, or_imm = 1, and_imm = 4, sub_imm = 5 };
+    enum AluReg : BYTE { add_rr = 0x01, or_rr = 0x09, and_rr = 0x21, sub_rr = 0x29, xor_rr = 0x31, mov_rr = 0x89 };
+    enum Shift : BYTE { shl = 4, shr = 5 };
+
+    static constexpr Reg base = rdi; // Chip8 *, first SysV argument
+
+    std::vector<BYTE> code;
+
+    auto load_byte(Reg dst, int32_t disp) -> void { // movzx dst, byte [base + disp]
+        rex(dst, base);
+        emit(0x0F, 0xB6);
+        modrm_mem(dst, disp);
+    }
+    auto store_byte(int32_t disp, Reg src) -> void { // mov byte [base + disp], src8
+        rex(src, base, src >= 4);                    // sil needs an (empty) REX prefix
+        emit(0x88);
+        modrm_mem(src, disp);
+    }
+    auto load_word(Reg dst, int32_t disp) -> void { // movzx dst, word [base + disp]
+        rex(dst, base);
+        emit(0x0F, 0xB7);
+        modrm_mem(dst, disp);
+    }
+    auto store_word(int32_t disp, Reg src) -> void { // mov word [base + disp], src16
+        emit(0x66);
+        rex(src, base);
+        emit(0x89);
+        modrm_mem(src, disp);
+    }
+    auto store_word_imm(int32_t disp, WORD imm) -> void { // mov word [base + disp], imm16
+        emit(0x66, 0xC7);
+        modrm_mem(0, disp);
+        emit(static_cast<BYTE>(imm), static_cast<BYTE>(imm >> 8));
+    }
+    auto add_qword_imm(int32_t disp, int32_t imm) -> void { // add qword [base + disp], imm32
+        emit(0x48, 0x81);                                    // REX.W, base needs no REX.B
+        modrm_mem(0, disp);
+        emit32(imm);
+    }
+    auto mov_imm(Reg dst, int32_t imm) -> void {
+        rex(0, dst);
+        emit(static_cast<BYTE>(0xB8 + (dst & 7)));
+        emit32(imm);
+    }
+    auto alu_imm(AluImm op, Reg dst, int32_t imm) -> void {
+        rex(0, dst);
+        emit(0x81);
+        modrm_reg(op, dst);
+        emit32(imm);
+    }
+    auto alu(AluReg op, Reg dst, Reg src) -> void {
+        rex(src, dst);
+        emit(op);
+        modrm_reg(src, dst);
+    }
+    auto shift(Shift op, Reg dst, BYTE amount) -> void {
+        rex(0, dst);
+        emit(0xC1);
+        modrm_reg(op, dst);
+        emit(amount);
+    }
+    auto imul_imm(Reg dst, Reg src, BYTE imm) -> void { // dst = src * imm8
+        rex(dst, src);
+        emit(0x6B);
+        modrm_reg(dst, src);
+        emit(imm);
+    }
+    auto ret() -> void { emit(0xC3); }
+
+private:
+    template <typename... Bytes>
+    auto emit(Bytes... bytes) -> void { (code.push_back(static_cast<BYTE>(bytes)), ...); }
+    auto emit32(int32_t v) -> void {
+        const auto u = static_cast<uint32_t>(v);
+        emit(u & 0xFF, (u >> 8) & 0xFF, (u >> 16) & 0xFF, (u >> 24) & 0xFF);
+    }
+    auto rex(BYTE reg, BYTE rm, bool force = false) -> void {
+        const BYTE prefix = 0x40 | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+        if (prefix != 0x40 || force) emit(prefix);
+    }
+    auto modrm_mem(BYTE reg, int32_t disp) -> void {
+        emit(0x80 | ((reg & 7) << 3) | (base & 7));
+        emit32(disp);
+    }
+    auto modrm_reg(BYTE reg, BYTE rm) -> void { emit(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+};
+#endif
+
+class BlockCache {
+public:
+    const Chip8 *owner = nullptr;
+    uint32_t epoch = 0;
+    Chip8Config config{};
+    std::array<Block, 4 * 1024> blocks{};
+#if CHIP8_JIT_AVAILABLE
+    CodeArena arena;
+#endif
+
+    auto flush(const Chip8 &c) -> void {
+        owner = &c;
+        epoch = c.code_epoch;
+        config = c.config;
+        blocks.fill(Block{});
+#if CHIP8_JIT_AVAILABLE
+        arena.reset();
+#endif
+    }
+    auto is_stale(const Chip8 &c) const -> bool {
+        return owner != &c || epoch != c.code_epoch || !(config == c.config);
+    }
+};
+
+inline CacheHandle::CacheHandle() = default;
+inline CacheHandle::CacheHandle(const CacheHandle &) {}
+inline CacheHandle::CacheHandle(CacheHandle &&) noexcept = default;
+inline auto CacheHandle::operator=(const CacheHandle &other) -> CacheHandle & {
+    if (this != &other) cache.reset();
+    return *this;
+}
+inline auto CacheHandle::operator=(CacheHandle &&) noexcept -> CacheHandle & = default;
+inline CacheHandle::~CacheHandle() = default;
+
+#if CHIP8_JIT_AVAILABLE
+inline auto is_compilable(Op id) -> bool {
+    switch (id) {
+    case Op::set_register:
+    case Op::add_to_register:
+    case Op::copy_register:
+    case Op::math_or:
+    case Op::math_and:
+    case Op::math_xor:
+    case Op::math_add:
+    case Op::math_sub:
+    case Op::shr:
+    case Op::subn:
+    case Op::shl:
+    case Op::set_i:
+    case Op::add_i:
+    case Op::set_i_sprite:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Bitmask of the V registers (bits 0-15) and I (bit 16) an instruction reads or writes. */
+inline auto registers_used(const Chip8Config &config, Op id, Instr i) -> uint32_t {
+    constexpr uint32_t VF = 1u << 0xF;
+    constexpr uint32_t I = 1u << 16;
+    const uint32_t X = 1u << i.X;
+    const uint32_t Y = 1u << i.Y;
+    switch (id) {
+    case Op::set_register:
+    case Op::add_to_register:
+        return X;
+    case Op::copy_register:
+    case Op::math_or:
+    case Op::math_and:
+    case Op::math_xor:
+        return X | Y;
+    case Op::math_add:
+    case Op::math_sub:
+    case Op::subn:
+        return X | Y | VF;
+    case Op::shr:
+    case Op::shl:
+        return X | VF | (config.legacy_shift ? Y : 0);
+    case Op::set_i:
+        return I;
+    case Op::add_i:
+        return X | I | ((config.legacy_add_index || config.modern_add_index_flush_vf) ? VF : 0);
+    case Op::set_i_sprite:
+        return X | I;
+    default:
+        return 0;
+    }
+}
+
+class Compiler {
+public:
+    using Reg = Emitter::Reg;
+
+    explicit Compiler(Chip8 &chip) : c(chip) {
+        const auto *self = reinterpret_cast<const char *>(&c);
+        off_VX = static_cast<int32_t>(reinterpret_cast<const char *>(c.VX.data()) - self);
+        off_I = static_cast<int32_t>(reinterpret_cast<const char *>(&c.I) - self);
+        off_PC = static_cast<int32_t>(reinterpret_cast<const char *>(&c.PC) - self);
+        off_iteration_counter = static_cast<int32_t>(reinterpret_cast<const char *>(&c.iteration_counter) - self);
+    }
+
+    /* Emits the block starting at `start`, returns its length in instructions (0 if nothing is compilable). */
+    auto compile(WORD start, Emitter &e) -> WORD {
+        // Pass 1: find the block extent and assign host registers to everything it touches
+        std::vector<DecodedInstr> body;
+        uint32_t used = 0;
+        for (size_t addr = start; addr + 1 < c.mem.size() && body.size() < max_block_length; addr += 2) {
+            const DecodedInstr &d = fetch_decoded(c, static_cast<WORD>(addr));
+            if (!is_compilable(d.id)) break;
+            const uint32_t next = used | registers_used(c.config, d.id, d.ins);
+            if (std::popcount(next) > static_cast<int>(pool.size())) break;
+            used = next;
+            body.push_back(d);
+        }
+        if (body.empty()) return 0;
+
+        size_t next_reg = 0;
+        for (size_t r = 0; r <= 16; ++r) {
+            if (used & (1u << r)) host[r] = pool[next_reg++];
+        }
+
+        // Pass 2: load, execute, write back
+        for (size_t r = 0; r < 16; ++r) {
+            if (used & (1u << r)) e.load_byte(host[r], off_VX + static_cast<int32_t>(r));
+        }
+        if (used & (1u << 16)) e.load_word(host[16], off_I);
+
+        for (const auto &d : body) emit_instr(e, d);
+
+        for (size_t r = 0; r < 16; ++r) {
+            if (used & (1u << r)) e.store_byte(off_VX + static_cast<int32_t>(r), host[r]);
+        }
+        if (used & (1u << 16)) e.store_word(off_I, host[16]);
+        e.store_word_imm(off_PC, static_cast<WORD>(start + 2 * body.size()));
+        e.add_qword_imm(off_iteration_counter, static_cast<int32_t>(body.size()));
+        e.ret();
+        return static_cast<WORD>(body.size());
+    }
+
+private:
+    static constexpr std::array<Reg, 7> pool = {
+        Emitter::rax, Emitter::rcx, Emitter::rdx, Emitter::rsi, Emitter::r8, Emitter::r9, Emitter::r10};
+    static constexpr Reg tmp = Emitter::r11;
+
+    Chip8 &c;
+    int32_t off_VX = 0;
+    int32_t off_I = 0;
+    int32_t off_PC = 0;
+    int32_t off_iteration_counter = 0;
+    std::array<Reg, 17> host{}; // V0..VF, then I
+
+    /* Mirrors the exec_* handlers, including the order in which VF and VX are written. */
+    auto emit_instr(Emitter &e, const DecodedInstr &d) -> void {
+        const Instr i = d.ins;
+        const Reg VX = host[i.X];
+        const Reg VY = host[i.Y];
+        const Reg VF = host[0xF];
+        const Reg I = host[16];
+        switch (d.id) {
+        case Op::set_register:
+            e.mov_imm(VX, i.NN);
+            break;
+        case Op::add_to_register:
+            e.alu_imm(Emitter::add_imm, VX, i.NN);
+            e.alu_imm(Emitter::and_imm, VX, 0xFF);
+            break;
+        case Op::copy_register:
+            e.alu(Emitter::mov_rr, VX, VY);
+            break;
+        case Op::math_or:
+            e.alu(Emitter::or_rr, VX, VY);
+            break;
+        case Op::math_and:
+            e.alu(Emitter::and_rr, VX, VY);
+            break;
+        case Op::math_xor:
+            e.alu(Emitter::xor_rr, VX, VY);
+            break;
+        case Op::math_add: // tmp = VX + VY, VF = tmp >> 8, VX = tmp & 0xFF
+            e.alu(Emitter::mov_rr, tmp, VX);
+            e.alu(Emitter::add_rr, tmp, VY);
+            emit_flag_then_result(e, VX, VF, 8);
+            break;
+        case Op::math_sub: // tmp = 0x100 + VX - VY, bit 8 is the NOT-borrow flag
+            e.alu(Emitter::mov_rr, tmp, VX);
+            e.alu_imm(Emitter::add_imm, tmp, 0x100);
+            e.alu(Emitter::sub_rr, tmp, VY);
+            emit_flag_then_result(e, VX, VF, 8);
+            break;
+        case Op::subn:
+            e.alu(Emitter::mov_rr, tmp, VY);
+            e.alu_imm(Emitter::add_imm, tmp, 0x100);
+            e.alu(Emitter::sub_rr, tmp, VX);
+            emit_flag_then_result(e, VX, VF, 8);
+            break;
+        case Op::shr:
+            e.alu(Emitter::mov_rr, tmp, c.config.legacy_shift ? VY : VX);
+            e.alu(Emitter::mov_rr, VF, tmp);
+            e.alu_imm(Emitter::and_imm, VF, 1);
+            e.alu(Emitter::mov_rr, VX, tmp);
+            e.shift(Emitter::shr, VX, 1);
+            break;
+        case Op::shl:
+            e.alu(Emitter::mov_rr, tmp, c.config.legacy_shift ? VY : VX);
+            e.alu(Emitter::mov_rr, VF, tmp);
+            e.shift(Emitter::shr, VF, 7);
+            e.alu(Emitter::mov_rr, VX, tmp);
+            e.shift(Emitter::shl, VX, 1);
+            e.alu_imm(Emitter::and_imm, VX, 0xFF);
+            break;
+        case Op::set_i:
+            e.mov_imm(I, i.NNN);
+            break;
+        case Op::add_i: // I <= 0xFFF so I + VX < 0x2000 and bit 12 is the overflow flag
+            e.alu(Emitter::add_rr, I, VX);
+            if (c.config.legacy_add_index) {
+                e.alu(Emitter::mov_rr, VF, I);
+                e.shift(Emitter::shr, VF, 12);
+            } else if (c.config.modern_add_index_flush_vf) {
+                e.mov_imm(VF, 0);
+            }
+            e.alu_imm(Emitter::and_imm, I, 0x0FFF);
+            break;
+        case Op::set_i_sprite:
+            e.alu(Emitter::mov_rr, I, VX);
+            e.alu_imm(Emitter::and_imm, I, 0x0F);
+            e.imul_imm(I, I, 5);
+            e.alu_imm(Emitter::add_imm, I, CONSTANTS::rom_font_start);
+            break;
+        default:
+            PANIC("JIT: tried to compile an unsupported instruction");
+        }
+    }
+
+    /* VF = tmp >> flag_shift, then VX = tmp & 0xFF (so VX wins if X == F, like the interpreter). */
+    static auto emit_flag_then_result(Emitter &e, Reg VX, Reg VF, BYTE flag_shift) -> void {
+        e.alu(Emitter::mov_rr, VF, tmp);
+        e.shift(Emitter::shr, VF, flag_shift);
+        e.alu(Emitter::mov_rr, VX, tmp);
+        e.alu_imm(Emitter::and_imm, VX, 0xFF);
+    }
+};
+
+inline auto lookup_or_compile(BlockCache &cache, Chip8 &c, WORD pc) -> const Block & {
+    Block &b = cache.blocks[pc];
+    if (b.compiled) return b;
+
+    Emitter e;
+    b.length = Compiler(c).compile(pc, e);
+    b.compiled = true;
+    if (b.length == 0) return b;
+
+    b.fn = cache.arena.append(e.code);
+    if (!b.fn) { // Arena full, start over with an empty cache
+        cache.flush(c);
+        return lookup_or_compile(cache, c, pc);
+    }
+    return b;
+}
+#endif
+} // namespace CHIP8::JIT
+
+namespace CHIP8 {
+/* Same semantics as calling fetch_and_execute `num_iterations` times. */
+inline auto run_jit(Chip8 &c, size_t num_iterations) -> void {
+#if CHIP8_JIT_AVAILABLE
+    if (!c.jit.cache) c.jit.cache = std::make_unique<JIT::BlockCache>();
+    JIT::BlockCache &cache = *c.jit.cache;
+
+    size_t remaining = num_iterations;
+    while (remaining > 0) {
+        if (cache.is_stale(c)) [[unlikely]] cache.flush(c);
+        if (c.PC > c.mem.size() - 2) PANIC("PC out of bounds");
+
+        const JIT::Block &b = JIT::lookup_or_compile(cache, c, c.PC);
+        if (b.length == 0 || b.length > remaining) {
+            const DecodedInstr &d = fetch_decoded(c, c.PC);
+            if (is_idle_candidate(d.id)) [[unlikely]] {
+                if (const size_t skipped = fast_forward_idle(c, d, remaining)) {
+                    remaining -= skipped;
+                    continue;
+                }
+            }
+            fetch_and_execute(c);
+            remaining -= 1;
+            continue;
+        }
+        b.fn(&c);
+        remaining -= b.length;
+    }
+#else
+    run_table(c, num_iterations);
+#endif
+}
+} // namespace CHIP8
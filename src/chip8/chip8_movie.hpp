@@ -0,0 +1,181 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Movies: a starting state plus every input applied to the machine afterwards, keyed by the number of
+instructions executed when it was applied. Emulation itself is deterministic (the RNG is part of the
+state), so replaying a movie reproduces the recorded run bit for bit, on any engine and any host.
+
+File layout, little-endian:
+
+    "C8MV"  u16 version  u16 reserved
+    u32 state size, state (see chip8_state.hpp)
+    varint input count, then per input: varint instructions since the previous input, u8 kind << 4 | key
+    varint instructions after the last input, u64 state_digest at the end of the recording
+*/
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "chip8.hpp"
+#include "chip8_state.hpp"
+
+namespace CHIP8 {
+inline constexpr std::array<BYTE, 4> movie_magic = {'C', '8', 'M', 'V'};
+inline constexpr uint16_t movie_version = 1;
+
+enum class MovieEvent : BYTE {
+    frame,    // end_frame
+    key_down, // press_key
+    key_up,   // release_key
+};
+
+struct MovieInput {
+    uint64_t instruction = 0; // Instructions executed since the movie started
+    MovieEvent kind = MovieEvent::frame;
+    BYTE key = 0;
+};
+
+struct Movie {
+    std::vector<BYTE> initial_state;
+    std::vector<MovieInput> inputs;
+    uint64_t length = 0;       // Instructions executed in total
+    uint64_t final_digest = 0; // state_digest when recording stopped
+};
+
+inline auto apply_input(Chip8 &c, MovieEvent kind, BYTE key) -> void {
+    switch (kind) {
+    case MovieEvent::frame:
+        end_frame(c);
+        break;
+    case MovieEvent::key_down:
+        press_key(c, key);
+        break;
+    case MovieEvent::key_up:
+        release_key(c, key);
+        break;
+    }
+}
+
+struct MovieRecorder {
+    Movie movie;
+    bool recording = false;
+    uint64_t start_counter = 0; // iteration_counter when recording started
+};
+
+/* Instructions executed since recording started. */
+inline auto recorded_instructions(const MovieRecorder &r, const Chip8 &c) -> uint64_t {
+    return c.iteration_counter - r.start_counter;
+}
+
+inline auto start_recording(MovieRecorder &r, const Chip8 &c) -> void {
+    r.movie = Movie{};
+    r.movie.initial_state = save_state(c);
+    r.recording = true;
+    r.start_counter = c.iteration_counter;
+}
+
+/* Call right after applying the input to `c`. */
+inline auto record_input(MovieRecorder &r, const Chip8 &c, MovieEvent kind, BYTE key = 0) -> void {
+    if (!r.recording) return;
+    r.movie.inputs.push_back(MovieInput{recorded_instructions(r, c), kind, key});
+}
+
+inline auto stop_recording(MovieRecorder &r, const Chip8 &c) -> Movie {
+    r.movie.length = recorded_instructions(r, c);
+    r.movie.final_digest = state_digest(c);
+    r.recording = false;
+    return std::move(r.movie);
+}
+
+/*
+Runs `c`, which must be in `m.initial_state`, through every input of the movie to its end.
+Returns whether the machine ended up in the recorded final state.
+*/
+inline auto play_movie(Chip8 &c, const Movie &m) -> bool {
+    // Wall-clock ticks can't be replayed, the recording ticked on its frame boundaries instead
+    if (c.timer_mode == TimerMode::realtime) c.timer_mode = TimerMode::host;
+    uint64_t executed = 0;
+    for (const MovieInput &input : m.inputs) {
+        step(c, input.instruction - executed);
+        executed = input.instruction;
+        apply_input(c, input.kind, input.key);
+    }
+    step(c, m.length - executed);
+    return state_digest(c) == m.final_digest;
+}
+
+inline auto save_movie(const Movie &m) -> std::vector<BYTE> {
+    std::vector<BYTE> out;
+    STATE::Writer w(out);
+    w.bytes(movie_magic);
+    w.u16(movie_version);
+    w.u16(0);
+    w.u32(static_cast<uint32_t>(m.initial_state.size()));
+    w.bytes(m.initial_state);
+    w.varint(m.inputs.size());
+    uint64_t previous = 0;
+    for (const MovieInput &input : m.inputs) {
+        w.varint(input.instruction - previous);
+        w.u8(static_cast<uint8_t>(static_cast<BYTE>(input.kind) << 4 | input.key));
+        previous = input.instruction;
+    }
+    w.varint(m.length - previous);
+    w.u64(m.final_digest);
+    return out;
+}
+
+inline auto load_movie(std::span<const BYTE> data) -> Movie {
+    STATE::Reader r(data);
+    std::array<BYTE, 4> magic{};
+    r.bytes(magic);
+    if (magic != movie_magic) throw std::runtime_error("Not a Chip8 movie");
+    const uint16_t version = r.u16();
+    if (version != movie_version) {
+        throw std::runtime_error(std::format("Unsupported Chip8 movie version {} (expected {})", version, movie_version));
+    }
+    r.u16();
+
+    Movie m;
+    const uint32_t state_bytes = r.u32();
+    if (state_bytes > r.remaining()) throw std::runtime_error("Unexpected end of data");
+    m.initial_state.resize(state_bytes);
+    r.bytes(m.initial_state);
+    const uint64_t count = r.varint();
+    if (count > r.remaining() / 2) throw std::runtime_error("Unexpected end of data"); // Inputs are >= 2 bytes
+    m.inputs.reserve(count);
+    uint64_t instruction = 0;
+    for (uint64_t k = 0; k < count; ++k) {
+        instruction += r.varint();
+        const uint8_t packed = r.u8();
+        if ((packed >> 4) > static_cast<uint8_t>(MovieEvent::key_up)) throw std::runtime_error("Invalid movie input");
+        m.inputs.push_back(MovieInput{instruction, static_cast<MovieEvent>(packed >> 4), static_cast<BYTE>(packed & 0xF)});
+    }
+    m.length = instruction + r.varint();
+    m.final_digest = r.u64();
+    if (r.remaining() != 0) throw std::runtime_error("Chip8 movie has trailing bytes");
+    return m;
+}
+
+inline auto save_movie_to_file(const Movie &m, const std::filesystem::path &filepath) -> void {
+    const std::vector<BYTE> data = save_movie(m);
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open movie file: " + filepath.string());
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+inline auto load_movie_from_file(const std::filesystem::path &filepath) -> Movie {
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open movie file: " + filepath.string());
+    const std::vector<BYTE> data(std::istreambuf_iterator<char>(file), {});
+    return load_movie(data);
+}
+} // namespace CHIP8
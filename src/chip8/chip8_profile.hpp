@@ -0,0 +1,88 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Reports on the counts Chip8::profile collects in CHIP8_PROFILE builds: the top entries for a live
+view, a CSV of every non-zero count and the call tree as folded stacks, one line per call stack
+("main;sub_2A4;sub_31C 1234"), the input format of flamegraph.pl, speedscope and friends.
+*/
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chip8.hpp"
+
+namespace CHIP8 {
+inline constexpr size_t profile_top_n = 8;
+
+struct ProfileEntry {
+    WORD key = 0; // Op or address
+    uint64_t count = 0;
+};
+using ProfileTop = std::array<ProfileEntry, profile_top_n>; // Descending, unused entries have count 0
+
+/* Highest counts first, ties by key. Fixed size so the emulation thread can publish it every frame. */
+template <size_t N>
+inline auto top_counts(const std::array<uint64_t, N> &counts) -> ProfileTop {
+    ProfileTop top{};
+    for (size_t k = 0; k < N; ++k) {
+        if (counts[k] <= top.back().count) continue;
+        size_t at = top.size() - 1;
+        for (; at > 0 && top[at - 1].count < counts[k]; --at) top[at] = top[at - 1];
+        top[at] = ProfileEntry{static_cast<WORD>(k), counts[k]};
+    }
+    return top;
+}
+
+/* Three letter mnemonic, e.g. "DRW". */
+inline auto op_mnemonic(Op id) -> std::string_view { return std::string_view(find_op(id)->fmt).substr(0, 3); }
+
+#if CHIP8_PROFILE
+inline auto reset_profile(Chip8 &c) -> void { c.profile = Profile{}; }
+
+/* Call stack of `node` in folded form, outermost first. */
+inline auto folded_stack(const Profile &p, uint32_t node) -> std::string {
+    std::vector<WORD> entries;
+    for (; node != 0; node = p.calls[node].parent) entries.push_back(p.calls[node].entry);
+    std::string stack = "main";
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) stack += std::format(";sub_{:03X}", *it);
+    return stack;
+}
+
+/* kind,address,instruction,count with kind op, pc or block, for every non-zero count. */
+inline auto save_profile_csv(const Chip8 &c, const std::filesystem::path &filepath) -> void {
+    std::ofstream file(filepath);
+    if (!file) throw std::runtime_error("Failed to open profile file: " + filepath.string());
+    const Profile &p = c.profile;
+    file << "kind,address,instruction,count\n";
+    for (size_t op = 0; op < p.per_op.size(); ++op) {
+        if (p.per_op[op]) file << std::format("op,,{},{}\n", op_mnemonic(static_cast<Op>(op)), p.per_op[op]);
+    }
+    const auto per_address = [&](std::string_view kind, const std::array<uint64_t, 4 * 1024> &counts) {
+        for (size_t addr = 0; addr + 1 < counts.size(); ++addr) {
+            if (!counts[addr]) continue;
+            const WORD w = static_cast<WORD>(c.mem[addr] << 8 | c.mem[addr + 1]);
+            file << std::format("{},0x{:03X},\"{}\",{}\n", kind, addr, disassemble(w), counts[addr]);
+        }
+    };
+    per_address("pc", p.per_pc);
+    per_address("block", p.per_block);
+}
+
+inline auto save_profile_folded(const Chip8 &c, const std::filesystem::path &filepath) -> void {
+    std::ofstream file(filepath);
+    if (!file) throw std::runtime_error("Failed to open profile file: " + filepath.string());
+    const Profile &p = c.profile;
+    for (uint32_t node = 0; node < p.calls.size(); ++node) {
+        if (p.calls[node].count) file << std::format("{} {}\n", folded_stack(p, node), p.calls[node].count);
+    }
+}
+#endif
+} // namespace CHIP8
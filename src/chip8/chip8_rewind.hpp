@@ -0,0 +1,221 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+History of recent machine states for stepping and scrubbing backwards in time.
+
+Every recorded frame is a `save_state` blob. Every `keyframe_interval`th one is stored whole, the
+frames in between as the XOR against their predecessor, run-length encoded. Consecutive frames
+mostly differ in a few display rows and registers, so a delta is typically tens of bytes where a
+keyframe is CHIP8::state_size.
+
+Records live back to back in one arena allocated up front, the oldest keyframe together with its
+deltas is evicted once the arena (or the record index) is full. Recording never allocates.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "../log.hpp"
+#include "chip8.hpp"
+#include "chip8_state.hpp"
+
+namespace CHIP8 {
+namespace REWIND {
+/*
+Delta format: (u16 equal bytes to skip, u16 n, n XOR bytes) repeated. Returns the encoded size, or
+nullopt if it would exceed `out.size()`, in which case storing a keyframe is cheaper anyway.
+*/
+inline auto encode_delta(std::span<const BYTE> from, std::span<const BYTE> to, std::span<BYTE> out)
+    -> std::optional<size_t> {
+    constexpr size_t max_run = 0xFFFF;
+    // Equal stretches shorter than this are cheaper to carry as literal zeros than to split the run
+    constexpr size_t min_skip = 4;
+    const size_t n = to.size();
+    size_t pos = 0;
+    size_t size = 0;
+    while (pos < n) {
+        size_t skip = 0;
+        while (pos + skip < n && skip < max_run && from[pos + skip] == to[pos + skip]) ++skip;
+        if (pos + skip == n) break;
+        size_t end = pos + skip;
+        size_t equal = 0;
+        while (end < n && end - pos - skip < max_run) {
+            equal = (from[end] == to[end]) ? equal + 1 : 0;
+            ++end;
+            if (equal == min_skip) break;
+        }
+        const size_t literal = end - pos - skip - equal;
+        if (size + 4 + literal > out.size()) return std::nullopt;
+        out[size++] = static_cast<BYTE>(skip);
+        out[size++] = static_cast<BYTE>(skip >> 8);
+        out[size++] = static_cast<BYTE>(literal);
+        out[size++] = static_cast<BYTE>(literal >> 8);
+        for (size_t k = pos + skip; k < pos + skip + literal; ++k) out[size++] = from[k] ^ to[k];
+        pos += skip + literal;
+    }
+    return size;
+}
+
+/* XOR is its own inverse, so this turns either end of an encoded delta into the other. */
+inline auto apply_delta(std::span<BYTE> state, std::span<const BYTE> delta) -> void {
+    size_t pos = 0;
+    for (size_t k = 0; k + 4 <= delta.size();) {
+        pos += static_cast<size_t>(delta[k] | (delta[k + 1] << 8));
+        const size_t literal = static_cast<size_t>(delta[k + 2] | (delta[k + 3] << 8));
+        k += 4;
+        for (size_t j = 0; j < literal; ++j) state[pos++] ^= delta[k++];
+    }
+}
+} // namespace REWIND
+
+class Rewind {
+public:
+    // Defaults hold several minutes of typical games at 60 frames per second
+    explicit Rewind(size_t arena_bytes = 16 * 1024 * 1024, size_t keyframe_interval = 60,
+                    size_t max_frames = 60 * 60 * 10)
+        : m_arena(arena_bytes), m_records(max_frames), m_keyframe_interval(keyframe_interval) {
+        if (arena_bytes < 2 * state_size || max_frames < 2 * keyframe_interval || keyframe_interval == 0) {
+            PANIC("Rewind buffer too small to hold two keyframes");
+        }
+        m_state.reserve(state_size);
+        m_previous.resize(state_size);
+        m_delta.resize(state_size);
+    }
+
+    /* Appends the state of `c` after the current frame, dropping any frames ahead of it first. */
+    auto record(const Chip8 &c) -> void {
+        if (m_count > 0) truncate_after(m_cursor);
+
+        m_state.clear();
+        save_state(c, m_state);
+        bool keyframe = m_count == 0 || frames_since_keyframe() + 1 >= m_keyframe_interval;
+        size_t size = state_size;
+        if (!keyframe) {
+            const auto delta = REWIND::encode_delta(m_previous, m_state, m_delta);
+            keyframe = !delta;
+            size = delta.value_or(state_size);
+        }
+
+        size_t offset = make_room(size);
+        if (m_count == 0 && !keyframe) { // Evicting made room by dropping the keyframe this delta builds on
+            keyframe = true;
+            size = state_size;
+            offset = make_room(size);
+        }
+        std::memcpy(&m_arena[offset], keyframe ? m_state.data() : m_delta.data(), size);
+
+        m_records[slot(m_count)] = Record{offset, static_cast<uint32_t>(size), keyframe};
+        m_count += 1;
+        m_write = offset + size;
+        m_used += size;
+        m_cursor = newest_frame();
+        std::swap(m_previous, m_state);
+    }
+
+    /* Restores `c` to how it was after `frame`, returns false if that frame is not retained. */
+    auto seek(Chip8 &c, uint64_t frame) -> bool {
+        if (m_count == 0 || frame < m_oldest || frame > newest_frame()) return false;
+        if (frame + 1 == m_cursor && !record_at(m_cursor).keyframe) {
+            REWIND::apply_delta(m_previous, payload(record_at(m_cursor)));
+        } else {
+            uint64_t key = frame;
+            while (!record_at(key).keyframe) --key;
+            const Record &r = record_at(key);
+            std::memcpy(m_previous.data(), &m_arena[r.offset], state_size);
+            for (uint64_t f = key + 1; f <= frame; ++f) REWIND::apply_delta(m_previous, payload(record_at(f)));
+        }
+        m_cursor = frame;
+        load_state(c, m_previous);
+        return true;
+    }
+    auto step_back(Chip8 &c) -> bool { return m_cursor > m_oldest && seek(c, m_cursor - 1); }
+
+    auto clear() -> void {
+        m_count = 0;
+        m_first = 0;
+        m_oldest = 0;
+        m_write = 0;
+        m_used = 0;
+        m_cursor = 0;
+    }
+
+    [[nodiscard]] auto empty() const -> bool { return m_count == 0; }
+    [[nodiscard]] auto oldest_frame() const -> uint64_t { return m_oldest; }
+    [[nodiscard]] auto newest_frame() const -> uint64_t { return m_oldest + m_count - 1; }
+    [[nodiscard]] auto cursor_frame() const -> uint64_t { return m_cursor; }
+    [[nodiscard]] auto bytes_used() const -> size_t { return m_used; }
+    [[nodiscard]] auto arena_bytes() const -> size_t { return m_arena.size(); }
+
+private:
+    struct Record {
+        size_t offset = 0;
+        uint32_t size = 0;
+        bool keyframe = false;
+    };
+
+    [[nodiscard]] auto slot(uint64_t index) const -> size_t { return (m_first + index) % m_records.size(); }
+    [[nodiscard]] auto record_at(uint64_t frame) const -> const Record & { return m_records[slot(frame - m_oldest)]; }
+    [[nodiscard]] auto payload(const Record &r) const -> std::span<const BYTE> {
+        return {&m_arena[r.offset], r.size};
+    }
+
+    [[nodiscard]] auto frames_since_keyframe() const -> size_t {
+        size_t n = 0;
+        while (!record_at(newest_frame() - n).keyframe) ++n;
+        return n;
+    }
+
+    auto truncate_after(uint64_t frame) -> void {
+        while (m_count > 0 && newest_frame() > frame) {
+            m_used -= m_records[slot(m_count - 1)].size;
+            m_count -= 1;
+        }
+        const Record &r = m_records[slot(m_count - 1)];
+        m_write = r.offset + r.size;
+    }
+
+    /* Drops the oldest keyframe and all deltas that depend on it. */
+    auto evict_oldest() -> void {
+        do {
+            m_used -= m_records[m_first].size;
+            m_first = (m_first + 1) % m_records.size();
+            m_count -= 1;
+            m_oldest += 1;
+        } while (m_count > 0 && !m_records[m_first].keyframe);
+    }
+
+    /* Returns where a record of `size` bytes goes, evicting whatever is in the way. */
+    auto make_room(size_t size) -> size_t {
+        if (m_write + size > m_arena.size()) {
+            // Everything past the write position is left over from the previous lap, i.e. oldest
+            while (m_count > 0 && m_records[m_first].offset >= m_write) evict_oldest();
+            m_write = 0;
+        }
+        while (m_count > 0 && (m_count == m_records.size() ||
+                                  (m_records[m_first].offset < m_write + size &&
+                                      m_records[m_first].offset + m_records[m_first].size > m_write))) {
+            evict_oldest();
+        }
+        return m_write;
+    }
+
+    std::vector<BYTE> m_arena;
+    std::vector<Record> m_records; // Ring, m_records[m_first] holds frame m_oldest
+    size_t m_keyframe_interval;
+    size_t m_first = 0;
+    size_t m_count = 0;
+    uint64_t m_oldest = 0; // Frames are numbered consecutively from the first record
+    size_t m_write = 0;
+    size_t m_used = 0;
+    uint64_t m_cursor = 0; // Frame the machine was last recorded at or restored to
+
+    std::vector<BYTE> m_state;    // Scratch for save_state
+    std::vector<BYTE> m_previous; // State at m_cursor, what the next delta is taken against
+    std::vector<BYTE> m_delta;
+};
+} // namespace CHIP8
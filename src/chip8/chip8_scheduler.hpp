@@ -0,0 +1,94 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Fixed-timestep driver that runs a machine at a configured instruction rate, independent of how often
+the host calls `advance` (vsync, window drags, slow frames).
+
+Wall-clock time is accumulated and drained in emulated 60Hz frames: each frame runs
+instructions_per_second / 60 instructions (fractions carry over), ends the frame (end_frame) and
+publishes the display to `presented`. The host renders `presented`, i.e. only completed frames.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "chip8.hpp"
+
+namespace CHIP8 {
+struct Scheduler {
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+    double instructions_per_second = CONSTANTS::default_instructions_per_second;
+    // Backlog beyond this is dropped instead of replayed in one burst, e.g. after a stall
+    seconds max_catch_up{0.25};
+
+    seconds accumulator{0.0};
+    double instruction_carry = 0.0; // Fraction of an instruction owed to the next frame
+    clock::time_point last_advance;
+    bool started = false;
+
+    Display presented = {};
+    uint32_t presented_dirty = 0; // Rows of `presented` changed since the host last took them
+    uint64_t frames_completed = 0;
+    seconds time_dropped{0.0};
+};
+
+inline constexpr Scheduler::seconds emulated_frame_time{1.0 / CONSTANTS::timer_frequency};
+
+/* Takes over wall-clock timers of `c`, either way they now tick in emulated time only. */
+inline auto attach(Scheduler &s, Chip8 &c) -> void {
+    if (c.timer_mode == TimerMode::realtime) c.timer_mode = TimerMode::host;
+    s.started = false;
+    s.accumulator = Scheduler::seconds{0.0};
+    s.instruction_carry = 0.0;
+    s.presented = c.display;
+    s.presented_dirty = ~uint32_t{0};
+}
+
+/* Runs one emulated 60Hz frame. */
+inline auto run_frame(Scheduler &s, Chip8 &c) -> void {
+    s.instruction_carry += s.instructions_per_second / CONSTANTS::timer_frequency;
+    const auto n = static_cast<size_t>(s.instruction_carry);
+    s.instruction_carry -= static_cast<double>(n);
+
+    if (n > 0) step(c, n);
+    end_frame(c);
+    if (const uint32_t dirty = take_dirty_rows(c)) {
+        s.presented = c.display;
+        s.presented_dirty |= dirty;
+    }
+    s.frames_completed += 1;
+}
+
+/* Catches the machine up to `now`, calling `on_frame(c)` after each emulated frame, returns how many completed. */
+template <typename OnFrame>
+inline auto advance(Scheduler &s, Chip8 &c, Scheduler::clock::time_point now, OnFrame &&on_frame) -> size_t {
+    if (!s.started) {
+        s.last_advance = now;
+        s.started = true;
+        return 0;
+    }
+    s.accumulator += now - s.last_advance;
+    s.last_advance = now;
+    if (s.accumulator > s.max_catch_up) {
+        s.time_dropped += s.accumulator - s.max_catch_up;
+        s.accumulator = s.max_catch_up;
+    }
+
+    size_t frames = 0;
+    while (s.accumulator >= emulated_frame_time) {
+        run_frame(s, c);
+        on_frame(c);
+        s.accumulator -= emulated_frame_time;
+        ++frames;
+    }
+    return frames;
+}
+inline auto advance(Scheduler &s, Chip8 &c, Scheduler::clock::time_point now) -> size_t {
+    return advance(s, c, now, [](const Chip8 &) {});
+}
+inline auto advance(Scheduler &s, Chip8 &c) -> size_t { return advance(s, c, Scheduler::clock::now()); }
+} // namespace CHIP8
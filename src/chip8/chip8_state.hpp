@@ -0,0 +1,265 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Snapshot and restore of the complete architectural state of a Chip8.
+
+The format is a flat, versioned little-endian byte stream (about 4.5 KB), independent of the host's
+endianness, struct layout and standard library, so a state saved on one machine resumes on another:
+
+    "C8ST"  u16 version  u16 reserved
+    mem[4096]  display[32] u64  PC u16  I u16  stack_pointer i16  stack[32] u16
+    delay_timer u8  sound_timer u8  VX[16]  iteration_counter u64
+    config u8 (bit flags)  keypad u16  just_pressed u16  rng_state u64
+    timer_mode u8  instructions_per_tick u32  tick_phase u32
+    dispatch u8  fuse_superinstructions u8
+
+Caches (decoded instructions, JIT blocks, dirty rows) are not saved, they are rebuilt after loading.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "chip8.hpp"
+
+namespace CHIP8 {
+inline constexpr std::array<BYTE, 4> state_magic = {'C', '8', 'S', 'T'};
+inline constexpr uint16_t state_version = 1;
+// Every state of this version has exactly this many bytes, see the layout above
+inline constexpr size_t state_size = 8 + 4 * 1024 + 32 * 8 + 6 + 32 * 2 + 2 + 16 + 8 + 13 + 9 + 2;
+
+namespace STATE {
+class Writer {
+public:
+    explicit Writer(std::vector<BYTE> &out) : m_out(out) {}
+
+    auto bytes(std::span<const BYTE> data) -> void { m_out.insert(m_out.end(), data.begin(), data.end()); }
+    auto u8(uint8_t v) -> void { m_out.push_back(v); }
+    auto u16(uint16_t v) -> void { le(v, 2); }
+    auto u32(uint32_t v) -> void { le(v, 4); }
+    auto u64(uint64_t v) -> void { le(v, 8); }
+    auto varint(uint64_t v) -> void { // LEB128, small values take one byte
+        for (; v >= 0x80; v >>= 7) m_out.push_back(static_cast<BYTE>(v | 0x80));
+        m_out.push_back(static_cast<BYTE>(v));
+    }
+
+private:
+    auto le(uint64_t v, int n) -> void {
+        for (int k = 0; k < n; ++k) m_out.push_back(static_cast<BYTE>(v >> (8 * k)));
+    }
+    std::vector<BYTE> &m_out;
+};
+
+class Reader {
+public:
+    explicit Reader(std::span<const BYTE> in) : m_in(in) {}
+
+    auto bytes(std::span<BYTE> data) -> void {
+        need(data.size());
+        std::copy_n(m_in.begin() + static_cast<std::ptrdiff_t>(m_pos), data.size(), data.begin());
+        m_pos += data.size();
+    }
+    auto u8() -> uint8_t { return static_cast<uint8_t>(le(1)); }
+    auto u16() -> uint16_t { return static_cast<uint16_t>(le(2)); }
+    auto u32() -> uint32_t { return static_cast<uint32_t>(le(4)); }
+    auto u64() -> uint64_t { return le(8); }
+    auto varint() -> uint64_t {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const BYTE b = u8();
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw std::runtime_error("Malformed varint");
+    }
+    [[nodiscard]] auto remaining() const -> size_t { return m_in.size() - m_pos; }
+
+private:
+    auto need(size_t n) const -> void {
+        if (remaining() < n) throw std::runtime_error("Unexpected end of data");
+    }
+    auto le(size_t n) -> uint64_t {
+        need(n);
+        uint64_t v = 0;
+        for (size_t k = 0; k < n; ++k) v |= static_cast<uint64_t>(m_in[m_pos++]) << (8 * k);
+        return v;
+    }
+    std::span<const BYTE> m_in;
+    size_t m_pos = 0;
+};
+
+inline auto pack_keys(const std::array<bool, 16> &keys) -> uint16_t {
+    uint16_t bits = 0;
+    for (size_t k = 0; k < keys.size(); ++k) bits |= static_cast<uint16_t>(keys[k] << k);
+    return bits;
+}
+inline auto unpack_keys(uint16_t bits, std::array<bool, 16> &keys) -> void {
+    for (size_t k = 0; k < keys.size(); ++k) keys[k] = (bits >> k) & 1;
+}
+
+inline auto pack_config(const Chip8Config &config) -> uint8_t {
+    return static_cast<uint8_t>(config.legacy_shift << 0 | config.legacy_add_index << 1 |
+                                config.modern_add_index_flush_vf << 2 | config.legacy_memory_dump << 3);
+}
+inline auto unpack_config(uint8_t bits) -> Chip8Config {
+    Chip8Config config;
+    config.legacy_shift = bits & (1 << 0);
+    config.legacy_add_index = bits & (1 << 1);
+    config.modern_add_index_flush_vf = bits & (1 << 2);
+    config.legacy_memory_dump = bits & (1 << 3);
+    return config;
+}
+} // namespace STATE
+
+/* Appends the state of `c` to `out`, reuse `out` across calls to avoid reallocating. */
+inline auto save_state(const Chip8 &c, std::vector<BYTE> &out) -> void {
+    STATE::Writer w(out);
+    w.bytes(state_magic);
+    w.u16(state_version);
+    w.u16(0);
+
+    w.bytes(c.mem);
+    for (const DisplayRow row : c.display) w.u64(row);
+    w.u16(c.PC);
+    w.u16(c.I);
+    w.u16(static_cast<uint16_t>(c.stack_pointer));
+    for (const WORD addr : c.stack) w.u16(addr);
+    w.u8(c.delay_timer);
+    w.u8(c.sound_timer);
+    w.bytes(c.VX);
+    w.u64(c.iteration_counter);
+
+    w.u8(STATE::pack_config(c.config));
+    w.u16(STATE::pack_keys(c.keypad));
+    w.u16(STATE::pack_keys(c.just_pressed));
+    w.u64(c.rng_state);
+    w.u8(static_cast<uint8_t>(c.timer_mode));
+    w.u32(c.instructions_per_tick);
+    w.u32(c.tick_phase);
+    w.u8(static_cast<uint8_t>(c.dispatch));
+    w.u8(c.fuse_superinstructions);
+}
+
+[[nodiscard]] inline auto save_state(const Chip8 &c) -> std::vector<BYTE> {
+    std::vector<BYTE> out;
+    save_state(c, out);
+    return out;
+}
+
+// The trailing dispatch and fuse_superinstructions bytes only pick an engine, all engines agree
+inline constexpr size_t state_host_bytes = 2;
+
+/* FNV-1a over the state without the host bytes, equal digests mean the machines are indistinguishable. */
+[[nodiscard]] inline auto state_digest(const Chip8 &c) -> uint64_t {
+    const std::vector<BYTE> state = save_state(c);
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t k = 0; k + state_host_bytes < state.size(); ++k) hash = (hash ^ state[k]) * 0x100000001B3;
+    return hash;
+}
+
+/* Replaces the state of `c`, throws std::runtime_error and leaves `c` untouched if `data` is not a valid state. */
+inline auto load_state(Chip8 &c, std::span<const BYTE> data) -> void {
+    STATE::Reader r(data);
+    std::array<BYTE, 4> magic{};
+    r.bytes(magic);
+    if (magic != state_magic) throw std::runtime_error("Not a Chip8 state");
+    const uint16_t version = r.u16();
+    if (version != state_version) {
+        throw std::runtime_error(std::format("Unsupported Chip8 state version {} (expected {})", version, state_version));
+    }
+    r.u16();
+
+    // Parsed into scratch space first so a truncated state can't leave `c` half overwritten
+    std::array<BYTE, 4 * 1024> mem{};
+    r.bytes(mem);
+    Display display{};
+    for (DisplayRow &row : display) row = r.u64();
+    const WORD PC = r.u16();
+    const WORD I = r.u16();
+    const int stack_pointer = static_cast<int16_t>(r.u16());
+    std::array<WORD, 32> stack{};
+    for (WORD &addr : stack) addr = r.u16();
+    const BYTE delay_timer = r.u8();
+    const BYTE sound_timer = r.u8();
+    std::array<BYTE, 16> VX{};
+    r.bytes(VX);
+    const uint64_t iteration_counter = r.u64();
+    const Chip8Config config = STATE::unpack_config(r.u8());
+    const uint16_t keypad = r.u16();
+    const uint16_t just_pressed = r.u16();
+    const uint64_t rng_state = r.u64();
+    const uint8_t timer_mode = r.u8();
+    const uint32_t instructions_per_tick = r.u32();
+    const uint32_t tick_phase = r.u32();
+    const uint8_t dispatch = r.u8();
+    const bool fuse_superinstructions = r.u8() != 0;
+
+    if (r.remaining() != 0) throw std::runtime_error("Chip8 state has trailing bytes");
+    if (stack_pointer < -1 || stack_pointer >= static_cast<int>(stack.size())) {
+        throw std::runtime_error("Chip8 state has an invalid stack pointer");
+    }
+    if (I >= mem.size()) throw std::runtime_error("Chip8 state has an invalid index register");
+    // Returned to addresses become PC, which has to leave room for a whole instruction
+    if (PC > mem.size() - 2) throw std::runtime_error("Chip8 state has an invalid program counter");
+    for (int k = 0; k <= stack_pointer; ++k) {
+        if (stack[static_cast<size_t>(k)] > mem.size() - 2) {
+            throw std::runtime_error("Chip8 state has an invalid stack entry");
+        }
+    }
+    if (dispatch > static_cast<uint8_t>(Dispatch::jit)) throw std::runtime_error("Chip8 state has an invalid dispatch");
+    if (timer_mode > static_cast<uint8_t>(TimerMode::instructions)) {
+        throw std::runtime_error("Chip8 state has an invalid timer mode");
+    }
+
+    c.mem = mem;
+    c.display = display;
+    c.PC = PC;
+    c.I = I;
+    c.stack_pointer = stack_pointer;
+    c.stack = stack;
+    c.delay_timer = delay_timer;
+    c.sound_timer = sound_timer;
+    c.VX = VX;
+    c.iteration_counter = iteration_counter;
+    c.config = config;
+    STATE::unpack_keys(keypad, c.keypad);
+    STATE::unpack_keys(just_pressed, c.just_pressed);
+    c.rng_state = rng_state;
+    c.timer_mode = static_cast<TimerMode>(timer_mode);
+    c.instructions_per_tick = instructions_per_tick;
+    c.tick_phase = tick_phase;
+    c.dispatch = static_cast<Dispatch>(dispatch);
+    c.fuse_superinstructions = fuse_superinstructions;
+
+    // The whole of memory may have changed, every cached decode and compiled block is stale
+    c.decoded.clear();
+    ++c.code_epoch;
+    c.dirty_rows = ~uint32_t{0};
+    c.idle = false;
+    c.last_timer_update = std::chrono::steady_clock::now();
+}
+
+inline auto save_state_to_file(const Chip8 &c, const std::filesystem::path &filepath) -> void {
+    const std::vector<BYTE> data = save_state(c);
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open state file: " + filepath.string());
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+inline auto load_state_from_file(Chip8 &c, const std::filesystem::path &filepath) -> void {
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open state file: " + filepath.string());
+    const std::vector<BYTE> data(std::istreambuf_iterator<char>(file), {});
+    load_state(c, data);
+}
+} // namespace CHIP8
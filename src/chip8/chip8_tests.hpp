@@ -1,5 +1,16 @@
 /* danielsinkin97@gmail.com */
+#include <thread>
+
+#include "../concurrency.hpp"
+#include "../trace.hpp"
 #include "chip8.hpp"
+#include "chip8_movie.hpp"
+#include "chip8_profile.hpp"
+#include "chip8_rewind.hpp"
+#include "chip8_scheduler.hpp"
+#include "chip8_state.hpp"
+#include "chip8_wide.hpp"
+#include "chip8_writer.hpp"
 
 namespace CHIP8::TESTS {
 auto opcode_roundtrip() -> void {
@@ -19,4 +30,982 @@ auto opcode_roundtrip() -> void {
         assert(doc.has_value());
     }
 }
-} // namespace CHIP8::TESTS
\ No newline at end of file
+
+/* Call/return pairs leave the stack where they found it, however many run one after another. */
+auto call_return_keeps_stack_balanced() -> void {
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+    ProgramWriter pw(c);
+    pw.call(0x300);
+    pw.jmp(CONSTANTS::rom_program_start);
+    pw.set_addr(0x300);
+    pw.ret();
+    for (int pair = 0; pair < 40; ++pair) { // More pairs than the stack has slots
+        fetch_and_execute(c);
+        assert(c.stack_pointer == 0 && c.PC == 0x300);
+        fetch_and_execute(c);
+        fetch_and_execute(c);
+        assert(c.stack_pointer == -1 && c.PC == CONSTANTS::rom_program_start);
+    }
+}
+
+auto decode_table_matches_linear_scan() -> void {
+    for (int raw = 0x0000; raw <= 0xFFFF; ++raw) {
+        WORD opcode = static_cast<WORD>(raw);
+        const OpInfo *expected = nullptr;
+        for (auto const &op : OPS) {
+            if ((opcode & op.mask) == op.pattern) {
+                expected = &op;
+                break;
+            }
+        }
+        assert(CHIP8::decode(opcode) == expected);
+    }
+}
+
+auto decoded_cache_invalidation() -> void {
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+
+    // Rewriting an already executed instruction through the ProgramWriter
+    ProgramWriter pw(c);
+    pw.ld_vx_byte(0x0, 0x05);
+    fetch_and_execute(c);
+    assert(c.VX[0x0] == 0x05);
+    pw.set_addr(CONSTANTS::rom_program_start);
+    pw.ld_vx_byte(0x0, 0x07);
+    c.PC = CONSTANTS::rom_program_start;
+    fetch_and_execute(c);
+    assert(c.VX[0x0] == 0x07);
+
+    // Self-modifying code: FX55 overwrites an instruction that already ran once
+    pw.set_addr(0x310);
+    pw.ld_vx_byte(0x2, 0x01);
+    c.PC = 0x310;
+    fetch_and_execute(c);
+    assert(c.VX[0x2] == 0x01);
+
+    pw.set_addr(0x300);
+    pw.ld_vx_byte(0x0, 0x62); // 0x6209 = V2 <- 0x09
+    pw.ld_vx_byte(0x1, 0x09);
+    pw.ld_i_addr(0x310);
+    pw.dump_vx(0x1);
+    pw.jmp(0x310);
+    c.PC = 0x300;
+    for (int k = 0; k < 6; ++k) fetch_and_execute(c);
+    assert(c.VX[0x2] == 0x09);
+
+    // Same for FX33, BCD(0x61) written at 0x31F turns the word at 0x320 into 0x0907
+    pw.set_addr(0x320);
+    pw.sys(0x000);
+    assert(fetch_decoded(c, 0x320).ins.w == 0x0000);
+    pw.set_addr(0x330);
+    pw.ld_vx_byte(0x3, 0x61);
+    pw.ld_i_addr(0x31F);
+    pw.bcd_vx(0x3);
+    c.PC = 0x330;
+    for (int k = 0; k < 3; ++k) fetch_and_execute(c);
+    assert(c.decoded[0x320].exec == nullptr);
+    assert(fetch_decoded(c, 0x320).ins.w == 0x0907);
+
+    // Copies start without a cache and decode their own memory, which may differ from then on
+    static Chip8 copy;
+    copy = c;
+    assert(copy.decoded.empty() && !c.decoded.empty());
+    copy.mem[0x321] = 0x08;
+    assert(fetch_decoded(copy, 0x320).ins.w == 0x0908 && fetch_decoded(c, 0x320).ins.w == 0x0907);
+}
+
+auto same_state(const Chip8 &a, const Chip8 &b) -> bool {
+    return a.mem == b.mem && display_kernels.equal(a.display, b.display) && a.PC == b.PC && a.I == b.I &&
+           a.stack_pointer == b.stack_pointer && a.stack == b.stack &&
+           a.delay_timer == b.delay_timer && a.sound_timer == b.sound_timer &&
+           a.VX == b.VX && a.iteration_counter == b.iteration_counter;
+}
+
+/* Deterministic loop touching every opcode class except RND, key input and control flow that could escape. */
+auto write_exercise_program(Chip8 &c) -> void {
+    ProgramWriter pw(c);
+    pw.ld_vx_byte(0x0, 0x00);
+    pw.ld_vx_byte(0x1, 0x03);
+    pw.ld_vx_byte(0x2, 0x77);
+    const WORD loop = pw.addr;
+    pw.add_vx_byte(0x0, 0x07);
+    pw.ld_vx_vy(0x3, 0x0);
+    pw.or_vx_vy(0x3, 0x1);
+    pw.and_vx_vy(0x3, 0x2);
+    pw.xor_vx_vy(0x3, 0x1);
+    pw.add_vx_vy(0x3, 0x0);
+    pw.ld_vx_vy(0x4, 0x3);
+    pw.sub_vx_vy(0x4, 0x1);
+    pw.shr_vx(0x4, 0x2);
+    pw.subn_vx_vy(0x4, 0x3);
+    pw.shl_vx(0x4, 0x0);
+    pw.skip_eq(0x0, 0x3F);
+    pw.add_vx_byte(0x5, 0x01);
+    pw.skip_not_eq(0x4, 0x10);
+    pw.add_vx_byte(0x6, 0x01);
+    pw.skip_eq_reg(0x3, 0x4);
+    pw.add_vx_byte(0x7, 0x01);
+    pw.skip_not_eq_reg(0x5, 0x6);
+    pw.add_vx_byte(0x8, 0x01);
+    pw.ld_f_vx(0x0);
+    pw.drw(0x0, 0x3, 0x5);
+    pw.ld_i_addr(0x400);
+    pw.add_i_vx(0x0);
+    pw.bcd_vx(0x3);
+    pw.dump_vx(0x4);
+    pw.fill_vx(0x8);
+    pw.set_delay(0x0);
+    pw.ld_vx_dt(0x9);
+    pw.set_sound(0x9);
+    pw.skip_not_eq(0x0, 0x00);
+    pw.cls();
+    pw.jmp(loop);
+}
+
+auto dispatch_engines_agree() -> void {
+    static Chip8 a, b;
+    for (int quirks = 0; quirks < 16; ++quirks) {
+        a = Chip8{};
+        initialise(a);
+        a.config.legacy_shift = quirks & 1;
+        a.config.legacy_add_index = quirks & 2;
+        a.config.modern_add_index_flush_vf = quirks & 4;
+        a.config.legacy_memory_dump = quirks & 8;
+        write_exercise_program(a);
+        b = a;
+        b.dispatch = Dispatch::switched;
+
+        for (int chunk = 0; chunk < 50; ++chunk) {
+            for (int k = 0; k < 97; ++k) fetch_and_execute(a);
+            run_switched(b, 97);
+            assert(same_state(a, b));
+        }
+    }
+}
+
+auto jit_matches_interpreter() -> void {
+    static Chip8 a, b;
+    for (int quirks = 0; quirks < 16; ++quirks) {
+        a = Chip8{};
+        initialise(a);
+        a.config.legacy_shift = quirks & 1;
+        a.config.legacy_add_index = quirks & 2;
+        a.config.modern_add_index_flush_vf = quirks & 4;
+        a.config.legacy_memory_dump = quirks & 8;
+        write_exercise_program(a);
+        b = a;
+        b.dispatch = Dispatch::jit;
+
+        for (int chunk = 0; chunk < 50; ++chunk) {
+            for (int k = 0; k < 97; ++k) fetch_and_execute(a);
+            run_jit(b, 97);
+            assert(same_state(a, b));
+        }
+    }
+
+    // Every register combination through the flag-setting ops, including X == F and Y == F
+    for (int quirks = 0; quirks < 2; ++quirks) {
+        a = Chip8{};
+        initialise(a);
+        a.config.legacy_shift = quirks;
+        ProgramWriter pw(a);
+        const WORD loop = pw.addr;
+        for (BYTE x = 0; x < 16; ++x) {
+            for (BYTE y = 0; y < 16; ++y) {
+                pw.add_vx_byte(x, static_cast<BYTE>(0x3B + 17 * y));
+                pw.add_vx_vy(x, y);
+                pw.sub_vx_vy(y, x);
+                pw.subn_vx_vy(x, y);
+                pw.shr_vx(x, y);
+                pw.shl_vx(y, x);
+            }
+        }
+        pw.jmp(loop);
+        b = a;
+        for (int chunk = 0; chunk < 20; ++chunk) {
+            for (int k = 0; k < 1031; ++k) fetch_and_execute(a);
+            run_jit(b, 1031);
+            assert(same_state(a, b));
+        }
+    }
+}
+
+/* A copy of a machine compiles its own blocks, so both can run on separate threads. */
+auto jit_copies_do_not_share_blocks() -> void {
+    static Chip8 reference, a, b;
+    reference = Chip8{};
+    initialise(reference);
+    write_exercise_program(reference);
+    a = reference;
+    a.dispatch = Dispatch::jit;
+    run_jit(a, 1000);
+    b = a;
+    assert(a.jit.cache && !b.jit.cache);
+
+    std::thread other([] { run_jit(b, 5000); });
+    run_jit(a, 5000);
+    other.join();
+    for (int k = 0; k < 6000; ++k) fetch_and_execute(reference);
+    assert(same_state(reference, a) && same_state(reference, b));
+    assert(a.jit.cache->owner == &a && b.jit.cache->owner == &b);
+}
+
+auto jit_self_modifying_code() -> void {
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+
+    // 0x200 runs a compiled block, then FX55 patches that very block and jumps back into it
+    ProgramWriter pw(c);
+    pw.ld_vx_byte(0x2, 0x01); // Patched to V2 <- 0x09
+    pw.add_vx_byte(0x3, 0x01);
+    pw.skip_eq(0x3, 0x02);
+    pw.jmp(0x300);
+    pw.jmp(0x400);
+    pw.set_addr(0x300);
+    pw.ld_vx_byte(0x0, 0x62);
+    pw.ld_vx_byte(0x1, 0x09);
+    pw.ld_i_addr(CONSTANTS::rom_program_start);
+    pw.dump_vx(0x1);
+    pw.jmp(CONSTANTS::rom_program_start);
+    pw.set_addr(0x400);
+    pw.jmp(0x400);
+
+    run_jit(c, 4);
+    assert(c.PC == 0x300 && c.VX[0x2] == 0x01);
+    run_jit(c, 5 + 4);
+    assert(c.PC == 0x400 && c.VX[0x2] == 0x09 && c.VX[0x3] == 0x02);
+}
+
+/* Contains every pattern in FUSIONS, including the skip-taken exits of the loop idioms. */
+auto write_fusion_program(Chip8 &c) -> void {
+    ProgramWriter pw(c);
+    pw.ld_vx_byte(0x0, 0x05);
+    pw.ld_vx_byte(0x1, 0x0A);
+    const WORD count_loop = pw.addr;
+    pw.ld_i_addr(CONSTANTS::rom_font_start);
+    pw.drw(0x0, 0x1, 0x5);
+    pw.add_vx_byte(0x0, 0x01);
+    pw.skip_eq(0x0, 0x40);
+    pw.jmp(count_loop);
+    pw.ld_vx_byte(0x2, 0x00);
+    pw.set_delay(0x2);
+    const WORD expired_wait = pw.addr;
+    pw.ld_vx_dt(0x3);
+    pw.skip_eq(0x3, 0x00);
+    pw.jmp(expired_wait);
+    pw.ld_vx_byte(0x2, 0x05);
+    pw.set_delay(0x2);
+    const WORD busy_wait = pw.addr;
+    pw.ld_vx_dt(0x3);
+    pw.skip_eq(0x3, 0x00);
+    pw.jmp(busy_wait);
+}
+
+auto fusion_matches_unfused() -> void {
+    static Chip8 a, b;
+    for (int program = 0; program < 2; ++program) {
+        a = Chip8{};
+        initialise(a);
+        if (program == 0) {
+            write_exercise_program(a);
+        } else {
+            write_fusion_program(a);
+        }
+        b = a;
+        b.fuse_superinstructions = true;
+
+        for (size_t chunk = 1; chunk < 200; ++chunk) {
+            const size_t n = chunk % 7; // Small budgets so fusions straddle the budget boundary
+            for (size_t k = 0; k < n; ++k) fetch_and_execute(a);
+            run_fused(b, n);
+            assert(same_state(a, b));
+        }
+    }
+    assert(fetch_decoded(b, CONSTANTS::rom_program_start).fusion != 0);
+}
+
+auto idle_fast_forward_matches_execution() -> void {
+    static Chip8 reference, fast;
+    for (int engine = 0; engine < 4; ++engine) {
+        for (size_t budget = 1; budget < 12; ++budget) {
+            reference = Chip8{};
+            initialise(reference);
+            write_fusion_program(reference); // Ends in a busy-wait on a non-zero delay timer
+            ProgramWriter pw(reference, 0x500);
+            pw.wait_key(0x4);
+
+            // Run up to the busy-wait, then once more from the FX0A with nothing pressed
+            for (int start = 0; start < 2; ++start) {
+                if (start == 1) reference.PC = 0x500;
+                for (int k = 0; k < 400; ++k) fetch_and_execute(reference);
+                fast = reference;
+                for (size_t k = 0; k < 5 * budget + 1; ++k) fetch_and_execute(reference);
+                const uint64_t skipped = fast.instructions_skipped;
+                switch (engine) {
+                case 0: run_table(fast, 5 * budget + 1); break;
+                case 1: run_switched(fast, 5 * budget + 1); break;
+                case 2: run_fused(fast, 5 * budget + 1); break;
+                case 3: run_jit(fast, 5 * budget + 1); break;
+                }
+                assert(same_state(reference, fast));
+                assert(fast.instructions_skipped > skipped || 5 * budget + 1 < 3);
+            }
+        }
+    }
+
+    // A step is idle only if it executed nothing at all
+    reference = Chip8{};
+    initialise(reference);
+    reference.timer_mode = TimerMode::host;
+    ProgramWriter pw(reference);
+    pw.add_vx_byte(0x0, 0x01);
+    pw.wait_key(0x4);
+    pw.jmp(CONSTANTS::rom_program_start);
+    step(reference, 100);
+    assert(!reference.idle && reference.instructions_skipped == 99);
+    step(reference, 100);
+    assert(reference.idle && reference.instructions_skipped == 199 && reference.iteration_counter == 200);
+    press_key(reference, 0x7);
+    step(reference, 100);
+    assert(!reference.idle && reference.VX[0x4] == 0x7);
+}
+
+/* The original one-byte-per-pixel DXYN, kept as the reference for the packed display. */
+auto reference_draw_sprite(ByteDisplay &display, const Chip8 &c, BYTE X, BYTE Y, BYTE N) -> BYTE {
+    const BYTE x0 = c.VX[X] % 64;
+    const BYTE y0 = c.VX[Y] % 32;
+    BYTE VF = 0;
+    for (int row = 0; row < N; ++row) {
+        const uint8_t sprite = c.mem[c.I + row];
+        for (int bit = 0; bit < 8; ++bit) {
+            const PIXEL px = (sprite >> (7 - bit)) & 1;
+            PIXEL &dst = display[(y0 + row) & 31][(x0 + bit) & 63];
+            if (dst && px) VF = 1;
+            dst ^= px;
+        }
+    }
+    return VF;
+}
+
+auto packed_display_matches_reference() -> void {
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+    ByteDisplay reference{};
+    std::mt19937 rng(0xC8);
+    for (int n = 0; n < 5000; ++n) {
+        c.I = 0x300;
+        for (int row = 0; row < 15; ++row) c.mem[c.I + row] = static_cast<BYTE>(rng());
+        c.VX[0x1] = static_cast<BYTE>(rng());
+        c.VX[0x2] = static_cast<BYTE>(rng());
+        const BYTE N = static_cast<BYTE>(rng() % 16);
+
+        const BYTE VF = reference_draw_sprite(reference, c, 0x1, 0x2, N);
+        draw_sprite(c, 0x1, 0x2, N);
+        assert(c.VX[0xF] == VF);
+        assert(expand_display(c.display) == reference);
+    }
+}
+
+/* Every SIMD kernel set the host can run must agree bit for bit with the scalar CLS and equality. */
+auto display_kernels_match_scalar() -> void {
+    std::vector<const DisplayKernels *> candidates;
+#if CHIP8_SIMD_X86
+    candidates.push_back(&KERNELS::sse2);
+    if (KERNELS::cpu_has_avx2()) candidates.push_back(&KERNELS::avx2);
+#endif
+    for (const DisplayKernels *kernels : candidates) {
+        Display reference{};
+        Display simd{};
+        std::mt19937 rng(0xC8);
+        std::array<BYTE, 15> sprite;
+        for (int n = 0; n < 5000; ++n) {
+            for (BYTE &b : sprite) b = static_cast<BYTE>(rng());
+            const BYTE x0 = rng() % display_width;
+            const BYTE y0 = rng() % display_height;
+            const BYTE N = static_cast<BYTE>(rng() % 16);
+
+            xor_sprite(reference, sprite.data(), N, x0, y0); // Only to vary the displays compared
+            assert(kernels->equal(simd, reference) == (simd == reference));
+            simd = reference;
+            assert(kernels->equal(simd, reference));
+
+            if (n % 97 == 0) {
+                simd[rng() % display_height] ^= DisplayRow{1} << (rng() % display_width);
+                assert(!kernels->equal(simd, reference));
+                simd = reference;
+            }
+            if (n % 500 == 0) {
+                kernels->clear(simd);
+                KERNELS::scalar.clear(reference);
+                assert(simd == Display{});
+            }
+        }
+    }
+}
+/* Instruction count and timer ticks follow emulated time, however the host slices wall-clock time. */
+auto scheduler_runs_at_fixed_rate() -> void {
+    using namespace std::chrono_literals;
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+    ProgramWriter pw(c);
+    pw.add_vx_byte(0x0, 0x01);
+    pw.jmp(CONSTANTS::rom_program_start);
+    c.delay_timer = 0xFF;
+
+    Scheduler s;
+    s.instructions_per_second = 1000.0;
+    attach(s, c);
+    const auto t0 = Scheduler::clock::time_point{};
+    advance(s, c, t0);
+    // One second in uneven host frames, ~144Hz with a hitch in the middle
+    auto t = t0;
+    for (int frame = 0; frame < 140; ++frame) {
+        t += (frame == 70) ? 16ms : 6944us;
+        advance(s, c, t);
+    }
+    const size_t frames = s.frames_completed;
+    assert(frames == static_cast<size_t>((t - t0) / emulated_frame_time));
+    assert(c.delay_timer == 0xFF - frames);
+    assert(static_cast<size_t>(c.iteration_counter) == static_cast<size_t>(frames * 1000.0 / 60.0));
+    assert(s.presented == c.display);
+
+    // A stall only replays max_catch_up worth of frames
+    advance(s, c, t + 10s);
+    assert(s.frames_completed - frames == static_cast<size_t>(s.max_catch_up / emulated_frame_time));
+    assert(s.time_dropped > 9s);
+}
+
+/* Arguments copied into a log record format exactly as they would have on the logging thread. */
+auto log_records_format_like_std_format() -> void {
+    const std::string path = "roms/some game.ch8";
+    const InstructionLine line{0x2A4, 0xD015};
+    const char *what = "file not found";
+
+    std::array<std::byte, LOGGING::arg_bytes> args;
+    std::byte *out = args.data();
+    LOGGING::encode(out, path);
+    LOGGING::encode(out, WORD{0x2A4});
+    LOGGING::encode(out, what);
+    LOGGING::encode(out, 2.5);
+    LOGGING::encode(out, line);
+    assert(static_cast<size_t>(out - args.data()) ==
+           LOGGING::encoded_size(path) + sizeof(WORD) + LOGGING::encoded_size(what) + sizeof(double) + sizeof line);
+
+    constexpr const char *fmt = "{} at {:#05X}: {} ({:.1f}) [{}]";
+    std::string formatted;
+    LOGGING::format_args<std::string_view, WORD, std::string_view, double, InstructionLine>(formatted, fmt, args.data());
+    assert(formatted == std::format(fmt, path, WORD{0x2A4}, what, 2.5, line));
+}
+
+/* A dump racing the recording thread sees whole events, in order, and the newest ones once the ring wraps. */
+auto trace_keeps_newest_whole_events() -> void {
+    static std::atomic<TRACE::ThreadBuffer *> buffer = nullptr;
+    static std::atomic<bool> done = false;
+    constexpr int64_t n = 3 * TRACE::events_per_thread + 123;
+
+    std::thread recorder([] {
+        TRACE::set_thread_name("recorder");
+        buffer = &TRACE::this_thread_buffer();
+        for (int64_t i = 0; i < n; ++i) buffer.load()->record("event", i, 2 * i);
+        done = true;
+    });
+    std::vector<TRACE::Event> events;
+    const auto check = [&events] {
+        assert(events.size() <= TRACE::events_per_thread);
+        for (size_t k = 0; k < events.size(); ++k) {
+            assert(events[k].name != nullptr && events[k].duration_ns == 2 * events[k].start_ns);
+            if (k > 0) assert(events[k].start_ns == events[k - 1].start_ns + 1);
+        }
+    };
+    while (!done) {
+        if (!buffer) continue;
+        events.clear();
+        buffer.load()->snapshot(events);
+        check();
+    }
+    recorder.join();
+    events.clear();
+    buffer.load()->snapshot(events);
+    check();
+    // The slot the next event goes to is never trusted, a write to it may be in flight
+    assert(events.size() == TRACE::events_per_thread - 1 && events.back().start_ns == n - 1);
+}
+
+/* A consumer racing the producer only ever sees whole frames, in order, and every queued item once. */
+auto emulation_handoff_is_consistent() -> void {
+    static CONCURRENCY::TripleBuffer<Display> frames;
+    static CONCURRENCY::SpscQueue<uint32_t, 64> queue;
+    constexpr uint32_t n = 200'000;
+
+    std::thread producer([] {
+        for (uint32_t i = 1; i <= n; ++i) {
+            frames.back().fill(i);
+            frames.publish();
+            while (!queue.push(i)) std::this_thread::yield();
+        }
+    });
+    DisplayRow last_frame = 0;
+    uint32_t expected = 1;
+    while (expected <= n) {
+        const Display &f = frames.read();
+        for (DisplayRow row : f) assert(row == f[0]);
+        assert(f[0] >= last_frame);
+        last_frame = f[0];
+        if (const auto item = queue.pop()) {
+            assert(*item == expected);
+            ++expected;
+        }
+    }
+    producer.join();
+    assert(frames.read()[0] == n);
+    assert(!queue.pop());
+}
+
+/* Every index runs exactly once however uneven the tasks, and a throwing task surfaces in the caller. */
+auto parallel_for_visits_every_index_once() -> void {
+    constexpr size_t n = 1000;
+    std::vector<std::atomic<int>> visits(n);
+    // Early indices are slow, so the threads owning them only finish if others steal their share
+    CONCURRENCY::parallel_for(n, 4, [&visits](size_t k) {
+        if (k < 16) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        visits[k].fetch_add(1, std::memory_order_relaxed);
+    });
+    for (const std::atomic<int> &v : visits) assert(v.load() == 1);
+
+    CONCURRENCY::parallel_for(0, 4, [](size_t) { assert(false); });
+    bool thrown = false;
+    try {
+        CONCURRENCY::parallel_for(n, 3, [](size_t k) {
+            if (k == 500) throw std::runtime_error("task failed");
+        });
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+/* Machines share no state, running several at once on separate threads ends each where it ends alone. */
+auto machines_run_independently() -> void {
+    constexpr size_t n = 6;
+    std::vector<std::unique_ptr<Chip8>> machines;
+    std::vector<uint64_t> alone;
+    for (size_t k = 0; k < n; ++k) {
+        Chip8 &c = *machines.emplace_back(std::make_unique<Chip8>());
+        initialise(c);
+        seed_random(c, k);
+        c.config.legacy_shift = k & 1;
+        c.dispatch = static_cast<Dispatch>(k % 3);
+        c.timer_mode = TimerMode::instructions;
+        c.instructions_per_tick = static_cast<uint32_t>(100 + k);
+        write_exercise_program(c);
+        const std::vector<BYTE> start = save_state(c);
+        step(c, 20'000 + 1'000 * k);
+        alone.push_back(state_digest(c));
+        load_state(c, start);
+    }
+    CONCURRENCY::parallel_for(n, n, [&machines](size_t k) { step(*machines[k], 20'000 + 1'000 * k); });
+    for (size_t k = 0; k < n; ++k) assert(state_digest(*machines[k]) == alone[k]);
+}
+
+/*
+A long 8XY* run, then random, data-dependent skips and a forward branch that split the lanes up until
+they meet again at the jump back. Returns the address of the `add VC, 1` on the branch.
+*/
+auto write_divergent_program(Chip8 &c) -> WORD {
+    ProgramWriter pw(c);
+    pw.ld_i_addr(0x500);
+    const WORD loop = pw.addr;
+    pw.add_vx_byte(0x1, 0x07);
+    pw.ld_vx_vy(0x2, 0x1);
+    pw.or_vx_vy(0x2, 0x0);
+    pw.xor_vx_vy(0x3, 0x2);
+    pw.add_vx_vy(0x3, 0x1);
+    pw.sub_vx_vy(0x4, 0x3);
+    pw.shr_vx(0x5, 0x4);
+    pw.subn_vx_vy(0x6, 0x5);
+    pw.shl_vx(0x7, 0x6);
+    pw.and_vx_vy(0x8, 0x7);
+    pw.add_vx_vy(0xF, 0x3);
+    pw.shl_vx(0xF, 0x2);
+    pw.ld_vx_byte(0x9, 0x11);
+    pw.sub_vx_vy(0x9, 0x9);
+    pw.rnd_vx_byte(0x0, 0x03);
+    pw.skip_eq(0x0, 0x01);
+    pw.add_vx_vy(0xA, 0x3);
+    pw.skip_not_eq_reg(0x3, 0x4);
+    pw.add_vx_byte(0xB, 0x03);
+    pw.skip_eq(0x0, 0x02);
+    pw.jmp(static_cast<WORD>(pw.addr + 8));
+    pw.bcd_vx(0x3);
+    pw.drw(0x1, 0x2, 0x3);
+    const WORD branch = pw.addr;
+    pw.add_vx_byte(0xC, 0x01);
+    pw.jmp(loop);
+    return branch;
+}
+
+/* Lane by lane, the wide engine ends where fetch_and_execute on a separate machine does. */
+template <size_t K>
+auto wide_lanes_match_scalar(bool mixed_quirks) -> void {
+    static Chip8 prototype;
+    prototype = Chip8{};
+    initialise(prototype);
+    const WORD branch = write_divergent_program(prototype);
+    auto wide = make_wide<K>(prototype);
+    std::vector<std::unique_ptr<Chip8>> reference;
+    for (size_t k = 0; k < K; ++k) {
+        Chip8 &c = *reference.emplace_back(std::make_unique<Chip8>(prototype));
+        seed_random(c, 0x5EED + k);
+        c.config.legacy_shift = mixed_quirks && (k % 3 == 1);
+        if (k == K / 2) { // Different code in one lane must keep the group out of lockstep there
+            c.mem[branch] = 0x8C;
+            c.mem[branch + 1] = 0x15; // 8C15 instead of 7C01
+            invalidate_decoded(c, branch, 2);
+        }
+        set_lane(*wide, k, c);
+    }
+
+    static Chip8 lane;
+    for (const size_t chunk : {1, 7, 64, 1000, 5000}) {
+        run_wide(*wide, chunk);
+        for (size_t k = 0; k < K; ++k) {
+            for (size_t n = 0; n < chunk; ++n) fetch_and_execute(*reference[k]);
+            get_lane(*wide, k, lane);
+            assert(same_state(lane, *reference[k]));
+            assert(state_digest(lane) == state_digest(*reference[k]));
+        }
+    }
+}
+
+/* Wide `step` ticks every lane's counted timers on the same instructions as scalar `step`. */
+auto wide_step_matches_scalar() -> void {
+    static Chip8 prototype;
+    prototype = Chip8{};
+    initialise(prototype);
+    write_exercise_program(prototype);
+    prototype.timer_mode = TimerMode::instructions;
+    auto wide = make_wide<4>(prototype);
+    std::vector<std::unique_ptr<Chip8>> reference;
+    for (size_t k = 0; k < 4; ++k) {
+        Chip8 &c = *reference.emplace_back(std::make_unique<Chip8>(prototype));
+        c.instructions_per_tick = static_cast<uint32_t>(50 + 37 * k);
+        set_lane(*wide, k, c);
+    }
+    static Chip8 lane;
+    for (int frame = 0; frame < 40; ++frame) {
+        step(*wide, 333);
+        for (size_t k = 0; k < 4; ++k) {
+            step(*reference[k], 333);
+            get_lane(*wide, k, lane);
+            assert(state_digest(lane) == state_digest(*reference[k]));
+        }
+    }
+}
+
+/* Every row DXYN or CLS changes is reported, and taking the mask clears it. */
+auto dirty_rows_cover_every_change() -> void {
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+    assert(take_dirty_rows(c) == 0);
+    std::mt19937 rng(0xD1);
+    for (int n = 0; n < 5000; ++n) {
+        c.I = 0x300;
+        for (int row = 0; row < 15; ++row) c.mem[c.I + row] = static_cast<BYTE>(rng());
+        c.VX[0x1] = static_cast<BYTE>(rng());
+        c.VX[0x2] = static_cast<BYTE>(rng());
+        const Display before = c.display;
+        if (n % 100 == 99) {
+            clear_display(c);
+        } else {
+            draw_sprite(c, 0x1, 0x2, static_cast<BYTE>(rng() % 16));
+        }
+        const uint32_t dirty = take_dirty_rows(c);
+        for (int y = 0; y < display_height; ++y) {
+            if (before[y] != c.display[y]) assert(dirty & (uint32_t{1} << y));
+        }
+        assert(take_dirty_rows(c) == 0);
+    }
+    toggle_pixel(c, 3, 31);
+    assert(take_dirty_rows(c) == uint32_t{1} << 31);
+}
+
+/* A restored machine continues exactly like the one it was saved from, malformed states are rejected. */
+auto state_roundtrip() -> void {
+    static Chip8 a, b;
+    a = Chip8{};
+    initialise(a);
+    a.config.legacy_shift = true;
+    a.keypad[0x7] = true;
+    write_exercise_program(a);
+    for (int k = 0; k < 1234; ++k) fetch_and_execute(a);
+    tick_timers(a, 3);
+
+    const std::vector<BYTE> saved = save_state(a);
+    assert(saved.size() == state_size);
+    b = Chip8{};
+    load_state(b, saved);
+    assert(same_state(a, b) && a.config == b.config && a.keypad == b.keypad && a.rng_state == b.rng_state);
+    assert(save_state(b) == saved);
+    for (int k = 0; k < 5000; ++k) {
+        fetch_and_execute(a);
+        fetch_and_execute(b);
+    }
+    assert(same_state(a, b));
+    for (int k = 0; k < 64; ++k) assert(random_byte(a) == random_byte(b));
+
+    const Chip8 untouched = b;
+    const auto rejects = [&](std::span<const BYTE> data) {
+        try {
+            load_state(b, data);
+        } catch (const std::runtime_error &) {
+            assert(same_state(b, untouched));
+            return true;
+        }
+        return false;
+    };
+    assert(rejects(std::span(saved).first(saved.size() - 1)));
+    std::vector<BYTE> corrupt = saved;
+    corrupt[0] = 'X';
+    assert(rejects(corrupt));
+    corrupt = saved;
+    corrupt[4] = state_version + 1;
+    assert(rejects(corrupt));
+    corrupt = saved;
+    corrupt[8 + 4 * 1024 + 32 * 8 + 3] = 0x10; // I = 0x1000, past the end of memory
+    assert(rejects(corrupt));
+    corrupt = saved;
+    corrupt[8 + 4 * 1024 + 32 * 8] = 0xFF; // PC = 0x0FFF, no room for the low byte of an instruction
+    corrupt[8 + 4 * 1024 + 32 * 8 + 1] = 0x0F;
+    assert(rejects(corrupt));
+    corrupt = saved;
+    constexpr size_t stack_at = 8 + 4 * 1024 + 32 * 8 + 4;
+    corrupt[stack_at] = corrupt[stack_at + 1] = 0; // stack_pointer = 0, stack[0] = 0xFFFF
+    corrupt[stack_at + 2] = corrupt[stack_at + 3] = 0xFF;
+    assert(rejects(corrupt));
+
+    // Counters past 32 bits survive
+    a.iteration_counter = 0x1'2345'6789;
+    load_state(b, save_state(a));
+    assert(b.iteration_counter == 0x1'2345'6789);
+}
+
+/* Every retained frame restores exactly, through wrap-around and eviction, and recording after a seek forks history. */
+auto rewind_restores_recorded_frames() -> void {
+    static Chip8 c;
+    c = Chip8{};
+    initialise(c);
+    ProgramWriter pw(c); // Random sprites, memory writes and timers, so every part of the state moves
+    pw.rnd_vx_byte(0x1, 0x3F);
+    pw.rnd_vx_byte(0x2, 0x1F);
+    pw.rnd_vx_byte(0x3, 0x0F);
+    pw.ld_f_vx(0x3);
+    pw.drw(0x1, 0x2, 0x5);
+    pw.add_vx_byte(0x4, 0x01);
+    pw.ld_i_addr(0x400);
+    pw.bcd_vx(0x4);
+    pw.set_delay(0x4);
+    pw.jmp(CONSTANTS::rom_program_start);
+
+    Rewind rewind(64 * 1024, 7, 200);
+    std::vector<std::vector<BYTE>> expected;
+    const auto run_frame = [&] {
+        for (int k = 0; k < 97; ++k) fetch_and_execute(c);
+        tick_timers(c);
+        rewind.record(c);
+        expected.push_back(save_state(c));
+    };
+    for (int frame = 0; frame < 600; ++frame) run_frame();
+    assert(rewind.newest_frame() == 599 && rewind.oldest_frame() > 0);
+    assert(rewind.bytes_used() <= rewind.arena_bytes());
+
+    static Chip8 restored;
+    for (uint64_t frame = rewind.oldest_frame(); frame <= rewind.newest_frame(); frame += 13) {
+        assert(rewind.seek(restored, frame));
+        assert(save_state(restored) == expected[frame]);
+    }
+    assert(!rewind.seek(restored, rewind.oldest_frame() - 1));
+    assert(!rewind.seek(restored, rewind.newest_frame() + 1));
+
+    assert(rewind.seek(c, rewind.newest_frame()));
+    for (int k = 0; k < 30; ++k) {
+        assert(rewind.step_back(c));
+        assert(save_state(c) == expected[rewind.cursor_frame()]);
+    }
+
+    // Continuing from an earlier frame drops the frames after it
+    const uint64_t fork = rewind.cursor_frame();
+    expected.resize(fork + 1);
+    for (int frame = 0; frame < 10; ++frame) run_frame();
+    assert(rewind.newest_frame() == fork + 10);
+    for (uint64_t frame = fork - 20; frame <= rewind.newest_frame(); ++frame) {
+        assert(rewind.seek(restored, frame));
+        assert(save_state(restored) == expected[frame]);
+    }
+}
+
+/* A recorded run replays to the identical final state on every engine, and a changed input diverges. */
+auto movie_replays_bit_identical() -> void {
+    static Chip8 recorded, replayed;
+    recorded = Chip8{};
+    initialise(recorded);
+    seed_random(recorded, 0x5EED);
+    recorded.timer_mode = TimerMode::host;
+    ProgramWriter pw(recorded); // Key-driven, random and timed, so inputs and their timing matter
+    const WORD loop = pw.addr;
+    pw.wait_key(0x0);
+    pw.rnd_vx_byte(0x1, 0x3F);
+    pw.rnd_vx_byte(0x2, 0x1F);
+    pw.ld_f_vx(0x0);
+    pw.drw(0x1, 0x2, 0x5);
+    pw.set_delay(0x0);
+    pw.ld_vx_dt(0x4);
+    pw.skip_eq(0x4, 0x00);
+    pw.jmp(pw.addr - 4);
+    pw.skip_not_pressed(0x0);
+    pw.add_vx_byte(0x3, 0x01);
+    pw.jmp(loop);
+    for (int k = 0; k < 500; ++k) fetch_and_execute(recorded); // Movies start from any state
+
+    MovieRecorder recorder;
+    start_recording(recorder, recorded);
+    std::mt19937 rng(0x30);
+    for (int frame = 0; frame < 2000; ++frame) {
+        step(recorded, 5 + rng() % 20);
+        end_frame(recorded);
+        record_input(recorder, recorded, MovieEvent::frame);
+        if (rng() % 8 == 0) {
+            const BYTE key = static_cast<BYTE>(rng() % 16);
+            const bool down = rng() % 2;
+            down ? press_key(recorded, key) : release_key(recorded, key);
+            record_input(recorder, recorded, down ? MovieEvent::key_down : MovieEvent::key_up, key);
+        }
+    }
+    step(recorded, 7);
+    const Movie movie = load_movie(save_movie(stop_recording(recorder, recorded)));
+    assert(movie.inputs.size() > 2000);
+
+    for (const Dispatch dispatch : {Dispatch::table, Dispatch::switched, Dispatch::jit}) {
+        replayed = Chip8{};
+        load_state(replayed, movie.initial_state);
+        replayed.dispatch = dispatch;
+        assert(play_movie(replayed, movie));
+        assert(same_state(recorded, replayed) && replayed.rng_state == recorded.rng_state);
+    }
+
+    Movie altered = movie;
+    for (MovieInput &input : altered.inputs) {
+        if (input.kind != MovieEvent::frame) input.key = (input.key + 1) % 16;
+    }
+    replayed = Chip8{};
+    load_state(replayed, altered.initial_state);
+    assert(!play_movie(replayed, altered));
+
+    // A state size past the end of the file is rejected before anything is allocated for it
+    std::vector<BYTE> corrupt = save_movie(movie);
+    corrupt[8] = corrupt[9] = corrupt[10] = corrupt[11] = 0xFF;
+    bool rejected = false;
+    try {
+        load_movie(corrupt);
+    } catch (const std::runtime_error &) {
+        rejected = true;
+    }
+    assert(rejected);
+}
+
+/* Counted ticks land on exact instruction boundaries for any split of the budget, idle loops included. */
+auto instruction_timers_tick_on_count() -> void {
+    static Chip8 reference, fast;
+    std::mt19937 rng(0x7C);
+    for (int engine = 0; engine < 4; ++engine) {
+        for (const uint32_t per_tick : {1u, 7u, 12u, 100u}) {
+            reference = Chip8{};
+            initialise(reference);
+            ProgramWriter pw(reference);
+            pw.ld_vx_byte(0x0, 0x05);
+            pw.set_delay(0x0);
+            const WORD wait = pw.addr; // The FX07 busy-wait fast_forward_idle recognises
+            pw.ld_vx_dt(0x1);
+            pw.skip_eq(0x1, 0x00);
+            pw.jmp(wait);
+            pw.add_vx_byte(0x2, 0x01);
+            pw.jmp(CONSTANTS::rom_program_start);
+            reference.timer_mode = TimerMode::instructions;
+            reference.instructions_per_tick = per_tick;
+            fast = reference;
+            fast.dispatch = (engine == 1) ? Dispatch::switched : (engine == 3) ? Dispatch::jit : Dispatch::table;
+            fast.fuse_superinstructions = engine == 2;
+
+            for (int chunk = 0; chunk < 200; ++chunk) {
+                const size_t budget = 1 + rng() % 150;
+                for (size_t k = 0; k < budget; ++k) {
+                    fetch_and_execute(reference);
+                    if (++reference.tick_phase == per_tick) {
+                        reference.tick_phase = 0;
+                        tick_timers(reference);
+                    }
+                }
+                step(fast, budget);
+                assert(same_state(reference, fast) && fast.tick_phase == reference.tick_phase);
+            }
+            assert(fast.VX[0x2] > 0); // The delay loop really ran out, repeatedly
+        }
+    }
+}
+
+/* Profiling leaves the run unchanged and counts every instruction once, per op, address, block and stack. */
+auto profile_counts_every_instruction() -> void {
+#if CHIP8_PROFILE
+    static Chip8 plain, profiled;
+    plain = Chip8{};
+    initialise(plain);
+    seed_random(plain, 0x9F);
+    ProgramWriter pw(plain);
+    pw.call(0x300);
+    pw.add_vx_byte(0x0, 0x01);
+    pw.jmp(CONSTANTS::rom_program_start);
+    pw.set_addr(0x300);
+    pw.call(0x310);
+    pw.ret();
+    pw.set_addr(0x310);
+    pw.rnd_vx_byte(0x1, 0x01);
+    pw.skip_eq(0x1, 0x00);
+    pw.add_vx_byte(0x2, 0x01);
+    pw.ret();
+    plain.timer_mode = TimerMode::instructions;
+    profiled = plain;
+    profiled.profiling = true;
+    plain.dispatch = Dispatch::jit;
+
+    constexpr uint64_t n = 10'000;
+    step(plain, n);
+    step(profiled, n);
+    assert(state_digest(plain) == state_digest(profiled));
+
+    const Profile &p = profiled.profile;
+    const auto sum = [](const auto &counts) {
+        uint64_t total = 0;
+        for (const uint64_t count : counts) total += count;
+        return total;
+    };
+    assert(sum(p.per_op) == n && sum(p.per_pc) == n);
+    uint64_t stacks = 0;
+    for (const Profile::CallNode &node : p.calls) stacks += node.count;
+    assert(stacks == n);
+    assert(p.calls.size() == 3 && folded_stack(p, 2) == "main;sub_300;sub_310");
+    assert(p.per_op[static_cast<size_t>(Op::call_subroutine)] == p.per_pc[0x200] + p.per_pc[0x300]);
+    // Blocks start at call and jump targets, after returns and after taken skips only
+    assert(p.per_block[0x310] == p.per_pc[0x310] && p.per_block[0x302] == p.per_pc[0x302]);
+    assert(p.per_block[0x316] == p.per_pc[0x316] - p.per_pc[0x314] && p.per_block[0x316] > 0);
+    assert(p.per_block[0x312] == 0 && p.per_block[0x314] == 0);
+    assert(top_counts(p.per_pc)[0].count == p.per_pc[0x200]);
+#endif
+}
+} // namespace CHIP8::TESTS
@@ -0,0 +1,270 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Wide engine: K machines stepped together, for fuzzing and search workloads that run one ROM under
+many seeds or inputs.
+
+The registers of all lanes are stored structure-of-arrays (VX[16][K], PC[K], I[K]), everything else
+(memory, display, stack, timers, keypad, config) stays in one Chip8 per lane. While every lane sits
+at the same PC in front of the same run of 6XNN / 7XNN / 8XY* instructions, that run executes once
+for all lanes, each instruction a loop over K contiguous bytes that the compiler turns into vector
+ops. Every other instruction, and every instruction while the lanes' PCs differ, executes lane by
+lane through fetch_and_execute, and diverged lanes are scheduled so that they meet again.
+
+Either way every lane ends exactly where a separate machine running fetch_and_execute would.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#include "chip8.hpp"
+
+namespace CHIP8 {
+template <size_t K>
+struct WideChip8 {
+    static_assert(K > 0, "A WideChip8 needs at least one lane");
+    using Lanes = std::array<BYTE, K>;
+
+    std::array<Lanes, 16> VX{}; // VX[x][lane]
+    std::array<WORD, K> PC{};
+    std::array<WORD, K> I{};
+    // VX, PC and I of these are stale, use set_lane / get_lane. Everything else (press_key, end_frame,
+    // display, ...) can be used on the lanes directly between runs.
+    std::array<std::unique_ptr<Chip8>, K> lanes;
+};
+
+template <size_t K>
+inline auto set_lane(WideChip8<K> &w, size_t k, const Chip8 &c) -> void {
+    *w.lanes[k] = c;
+    for (size_t x = 0; x < 16; ++x) w.VX[x][k] = c.VX[x];
+    w.PC[k] = c.PC;
+    w.I[k] = c.I;
+}
+
+template <size_t K>
+inline auto get_lane(const WideChip8<K> &w, size_t k, Chip8 &out) -> void {
+    out = *w.lanes[k];
+    for (size_t x = 0; x < 16; ++x) out.VX[x] = w.VX[x][k];
+    out.PC = w.PC[k];
+    out.I = w.I[k];
+}
+
+/* Every lane starts out as a copy of `prototype`. */
+template <size_t K>
+[[nodiscard]] inline auto make_wide(const Chip8 &prototype) -> std::unique_ptr<WideChip8<K>> {
+    auto w = std::make_unique<WideChip8<K>>();
+    for (size_t k = 0; k < K; ++k) {
+        w->lanes[k] = std::make_unique<Chip8>();
+        set_lane(*w, k, prototype);
+    }
+    return w;
+}
+
+namespace WIDE {
+/* Executes lane `k` alone for one instruction, through the same handlers as every other engine. */
+template <size_t K>
+inline auto step_lane(WideChip8<K> &w, size_t k) -> void {
+    Chip8 &c = *w.lanes[k];
+    for (size_t x = 0; x < 16; ++x) c.VX[x] = w.VX[x][k];
+    c.PC = w.PC[k];
+    c.I = w.I[k];
+    fetch_and_execute(c);
+    for (size_t x = 0; x < 16; ++x) w.VX[x][k] = c.VX[x];
+    w.PC[k] = c.PC;
+    w.I[k] = c.I;
+}
+
+inline auto is_lockstep_op(Op id, bool uniform_shift) -> bool {
+    switch (id) {
+    case Op::set_register:
+    case Op::add_to_register:
+    case Op::copy_register:
+    case Op::math_or:
+    case Op::math_and:
+    case Op::math_xor:
+    case Op::math_add:
+    case Op::math_sub:
+    case Op::subn:
+        return true;
+    case Op::shr:
+    case Op::shl:
+        return uniform_shift; // Lanes disagreeing on legacy_shift disagree on what a shift does
+    default:
+        return false;
+    }
+}
+
+/*
+Number of instructions, at most `limit`, that all lanes can execute in lockstep from their common
+PC: lockstep ops only, and the same words in every lane's memory.
+*/
+template <size_t K>
+inline auto lockstep_length(WideChip8<K> &w, size_t limit, bool uniform_shift) -> size_t {
+    const WORD pc = w.PC[0];
+    Chip8 &first = *w.lanes[0];
+    size_t n = 0;
+    while (n < limit && pc + 2 * n <= first.mem.size() - 2 &&
+           is_lockstep_op(fetch_decoded(first, static_cast<WORD>(pc + 2 * n)).id, uniform_shift)) {
+        ++n;
+    }
+    for (size_t k = 1; k < K && n > 0; ++k) {
+        const BYTE *code = &w.lanes[k]->mem[pc];
+        const BYTE *mismatch = std::mismatch(code, code + 2 * n, &first.mem[pc]).first;
+        n = std::min<size_t>(n, (mismatch - code) / 2);
+    }
+    return n;
+}
+
+/* `i` for every lane at once. Mirrors the exec_* handlers, including VF being written before VX. */
+template <size_t K>
+inline auto execute_lockstep(WideChip8<K> &w, Op id, Instr i, bool legacy_shift) -> void {
+    using Lanes = typename WideChip8<K>::Lanes;
+    Lanes &vx = w.VX[i.X];
+    const Lanes vy = w.VX[i.Y]; // Copy, X may equal Y
+    Lanes result;
+    Lanes flag;
+    switch (id) {
+    case Op::set_register:
+        vx.fill(i.NN);
+        return;
+    case Op::add_to_register:
+        for (size_t k = 0; k < K; ++k) vx[k] = static_cast<BYTE>(vx[k] + i.NN);
+        return;
+    case Op::copy_register:
+        vx = vy;
+        return;
+    case Op::math_or:
+        for (size_t k = 0; k < K; ++k) vx[k] |= vy[k];
+        return;
+    case Op::math_and:
+        for (size_t k = 0; k < K; ++k) vx[k] &= vy[k];
+        return;
+    case Op::math_xor:
+        for (size_t k = 0; k < K; ++k) vx[k] ^= vy[k];
+        return;
+    case Op::math_add:
+        for (size_t k = 0; k < K; ++k) {
+            result[k] = static_cast<BYTE>(vx[k] + vy[k]);
+            flag[k] = result[k] < vx[k]; // Carry
+        }
+        break;
+    case Op::math_sub:
+        for (size_t k = 0; k < K; ++k) {
+            result[k] = static_cast<BYTE>(vx[k] - vy[k]);
+            flag[k] = vx[k] >= vy[k];
+        }
+        break;
+    case Op::subn:
+        for (size_t k = 0; k < K; ++k) {
+            result[k] = static_cast<BYTE>(vy[k] - vx[k]);
+            flag[k] = vy[k] >= vx[k];
+        }
+        break;
+    case Op::shr: {
+        const Lanes &src = legacy_shift ? vy : vx;
+        for (size_t k = 0; k < K; ++k) {
+            result[k] = src[k] >> 1;
+            flag[k] = src[k] & 1;
+        }
+        break;
+    }
+    case Op::shl: {
+        const Lanes &src = legacy_shift ? vy : vx;
+        for (size_t k = 0; k < K; ++k) {
+            result[k] = static_cast<BYTE>(src[k] << 1);
+            flag[k] = src[k] >> 7;
+        }
+        break;
+    }
+    default:
+        PANIC("WIDE: not a lockstep instruction");
+    }
+    w.VX[0xF] = flag;
+    vx = result; // Wins over the flag when X == F, as in the scalar handlers
+}
+} // namespace WIDE
+
+/*
+Same end state for every lane as calling fetch_and_execute `num_iterations` times on it.
+
+Each lane has its own budget, so diverged lanes need not advance together: only the lanes furthest
+back in the code run (the min-PC rule of SIMT hardware). Lanes that skipped ahead wait at the join
+point until the others catch up, and from there the whole group runs in lockstep again.
+*/
+template <size_t K>
+inline auto run_wide(WideChip8<K> &w, size_t num_iterations) -> void {
+    bool uniform_shift = true;
+    for (size_t k = 1; k < K; ++k) {
+        uniform_shift = uniform_shift && w.lanes[k]->config.legacy_shift == w.lanes[0]->config.legacy_shift;
+    }
+    const bool legacy_shift = w.lanes[0]->config.legacy_shift;
+
+    std::array<size_t, K> remaining;
+    remaining.fill(num_iterations);
+    while (true) {
+        bool active = false;
+        bool converged = true;
+        WORD min_pc = 0xFFFF;
+        for (size_t k = 0; k < K; ++k) {
+            converged = converged && remaining[k] > 0 && w.PC[k] == w.PC[0];
+            if (remaining[k] == 0) continue;
+            active = true;
+            min_pc = std::min(min_pc, w.PC[k]);
+        }
+        if (!active) return;
+        if (converged) {
+            const size_t min_remaining = *std::min_element(remaining.begin(), remaining.end());
+            if (const size_t n = WIDE::lockstep_length(w, min_remaining, uniform_shift)) {
+                Chip8 &first = *w.lanes[0];
+                for (size_t j = 0; j < n; ++j) {
+                    const DecodedInstr &d = fetch_decoded(first, static_cast<WORD>(w.PC[0] + 2 * j));
+                    WIDE::execute_lockstep(w, d.id, d.ins, legacy_shift);
+                }
+                for (size_t k = 0; k < K; ++k) {
+                    w.PC[k] = static_cast<WORD>(w.PC[k] + 2 * n);
+                    w.lanes[k]->iteration_counter += n;
+                    remaining[k] -= n;
+                }
+                continue;
+            }
+        }
+        for (size_t k = 0; k < K; ++k) {
+            if (remaining[k] == 0 || w.PC[k] != min_pc) continue;
+            WIDE::step_lane(w, k);
+            remaining[k] -= 1;
+        }
+    }
+}
+
+/* `step` for every lane: same budget, each lane's timers tick as its own timer_mode says. */
+template <size_t K>
+inline auto step(WideChip8<K> &w, size_t num_iterations) -> void {
+    for (const std::unique_ptr<Chip8> &lane : w.lanes) {
+        update_timers(*lane);
+        lane->idle = false;
+    }
+    while (num_iterations > 0) {
+        // Up to the first tick boundary of any lane counting instructions
+        size_t chunk = num_iterations;
+        for (const std::unique_ptr<Chip8> &lane : w.lanes) {
+            if (lane->timer_mode != TimerMode::instructions) continue;
+            const uint32_t per_tick = std::max<uint32_t>(lane->instructions_per_tick, 1);
+            lane->tick_phase = std::min(lane->tick_phase, per_tick - 1);
+            chunk = std::min<size_t>(chunk, per_tick - lane->tick_phase);
+        }
+        run_wide(w, chunk);
+        num_iterations -= chunk;
+        for (const std::unique_ptr<Chip8> &lane : w.lanes) {
+            if (lane->timer_mode != TimerMode::instructions) continue;
+            lane->tick_phase += static_cast<uint32_t>(chunk);
+            if (lane->tick_phase == std::max<uint32_t>(lane->instructions_per_tick, 1)) {
+                lane->tick_phase = 0;
+                tick_timers(*lane);
+            }
+        }
+    }
+}
+} // namespace CHIP8
@@ -1,6 +1,5 @@
 #pragma once
 
-#include "../types.hpp"
 #include "chip8.hpp"
 
 namespace CHIP8 {
@@ -13,7 +12,7 @@ public:
 
     /// Create a ProgramWriter for `chip`, starting at `start`.
     explicit ProgramWriter(Chip8 &chip, WORD start = CONSTANTS::rom_program_start)
-        : c(chip), addr(start) {}
+        : addr(start), c(chip) {}
 
     /// (0NNN) Jump to system routine at NNN (ignored by most interpreters).
     void sys(WORD nnn) { write_encoded(Op::sys, 0, 0, 0, 0, nnn); }
@@ -146,6 +145,7 @@ public:
                 if (c.mem[i] != 0x00) ++lost_non_zero;
             std::fill(c.mem.begin() + start,
                 c.mem.begin() + start + block_len, 0x00);
+            invalidate_decoded(c, start, block_len);
 
             LOG_WARN("Shift of {} byte(s) from 0x{:03X} exceeds RAM – truncated "
                      "{} non-zero byte(s).  No data moved.",
@@ -169,6 +169,7 @@ public:
             if (block_len == 0) {
                 std::fill(c.mem.begin() + start,
                     c.mem.begin() + start + n, 0x00);
+                invalidate_decoded(c, start, n);
                 return;
             }
         }
@@ -190,6 +191,7 @@ public:
             c.mem.begin() + start + n + block_len);
         std::fill(c.mem.begin() + start,
             c.mem.begin() + start + n, 0x00);
+        invalidate_decoded(c, start, n + block_len);
 
         if (overwritten_non_zero)
             LOG_WARN("{} non-zero byte(s) were overwritten during the shift.",
@@ -234,6 +236,7 @@ public:
 
         // actually zero the bytes
         std::fill(c.mem.begin() + start, c.mem.begin() + end, 0x00);
+        invalidate_decoded(c, start, end - start);
 
         LOG_INFO("Cleared {} byte(s) in [0x{:03X}..0x{:03X}), wiped {} non-zero instruction(s)",
             end - start, start, end, wiped_instructions);
@@ -253,10 +256,11 @@ private:
 
         if ((X > 0xF) || (Y > 0xF)) PANIC("Register index out of range");
         if (N > 0xF) PANIC("N out of bounds.");
-        if (addr + 1 >= c.mem.size()) PANIC("Program Writer addr overflow!");
+        if (addr + 1u >= c.mem.size()) PANIC("Program Writer addr overflow!");
         const auto *op = find_op(id);
         if (!op) throw std::runtime_error("Unknown opcode ID");
         WORD instr = op->encode(X, Y, N, NN, NNN);
+        invalidate_decoded(c, addr, 2);
         c.mem[addr++] = BYTE(instr >> 8);
         c.mem[addr++] = BYTE(instr & 0xFF);
     }
@@ -0,0 +1,168 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Lock-free single-producer / single-consumer primitives for handing data between two threads, and a
+work-stealing `parallel_for` for spreading independent tasks over all cores.
+*/
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace CONCURRENCY {
+/* Cache line size, keeps the producer and consumer side of the structures below from false sharing. */
+inline constexpr size_t cache_line = 64;
+
+/*
+Latest-value exchange: the producer fills `back()` and `publish()`es it, the consumer `read()`s the
+most recently published value. Neither side ever waits and each owns its slot exclusively until it
+trades it in, so the consumer can't observe a half-written value. Values published between two
+reads are skipped.
+*/
+template <typename T>
+class TripleBuffer {
+public:
+    /* Producer side. */
+    auto back() -> T & { return m_slots[m_back]; }
+    auto publish() -> void {
+        const uint8_t previous = m_middle.exchange(m_back | fresh_bit, std::memory_order_acq_rel);
+        m_back = previous & index_mask;
+    }
+
+    /* Consumer side, keeps returning the same value until a newer one is published. */
+    auto read() -> const T & {
+        if (m_middle.load(std::memory_order_relaxed) & fresh_bit) {
+            const uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+            m_front = previous & index_mask;
+        }
+        return m_slots[m_front];
+    }
+
+private:
+    static constexpr uint8_t index_mask = 0x3;
+    static constexpr uint8_t fresh_bit = 0x4; // Middle slot holds a value the consumer has not seen yet
+
+    std::array<T, 3> m_slots = {};
+    alignas(cache_line) std::atomic<uint8_t> m_middle{1};
+    alignas(cache_line) uint8_t m_back = 0;
+    alignas(cache_line) uint8_t m_front = 2;
+};
+
+/* Bounded FIFO for exactly one pushing and one popping thread. */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+
+public:
+    /* Returns false and drops `value` if the queue is full. */
+    auto push(const T &value) -> bool {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail_cache == Capacity) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head - m_tail_cache == Capacity) return false;
+        }
+        m_items[head & (Capacity - 1)] = value;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    auto pop() -> std::optional<T> {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head_cache) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail == m_head_cache) return std::nullopt;
+        }
+        T value = m_items[tail & (Capacity - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return value;
+    }
+
+private:
+    std::array<T, Capacity> m_items = {};
+    // Producer: head plus its last view of tail, consumer: tail plus its last view of head
+    alignas(cache_line) std::atomic<size_t> m_head{0};
+    size_t m_tail_cache = 0;
+    alignas(cache_line) std::atomic<size_t> m_tail{0};
+    size_t m_head_cache = 0;
+};
+/*
+Calls `fn(k)` exactly once for every k in [0, n), on `threads` threads including the calling one.
+Each thread starts on its own contiguous share of the indices and, once that runs dry, steals the
+upper half of what another thread has left, so tasks of very uneven cost still keep every core busy.
+If `fn` throws, the remaining tasks are skipped and the first exception is rethrown here.
+*/
+template <typename Fn>
+inline auto parallel_for(size_t n, size_t threads, Fn &&fn) -> void {
+    threads = std::clamp<size_t>(threads, 1, std::max<size_t>(n, 1));
+
+    // Indices [begin, end) a thread has left, the owner takes from the front and thieves from the back
+    struct alignas(cache_line) Range {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+    std::vector<Range> ranges(threads);
+    for (size_t t = 0; t < threads; ++t) {
+        ranges[t].begin = n * t / threads;
+        ranges[t].end = n * (t + 1) / threads;
+    }
+
+    const auto next = [&ranges, threads](size_t t) -> std::optional<size_t> {
+        Range &own = ranges[t];
+        {
+            std::lock_guard lock(own.mutex);
+            if (own.begin < own.end) return own.begin++;
+        }
+        for (size_t k = 1; k < threads; ++k) {
+            Range &victim = ranges[(t + k) % threads];
+            size_t begin = 0;
+            size_t end = 0;
+            {
+                std::lock_guard lock(victim.mutex);
+                if (victim.begin == victim.end) continue;
+                begin = victim.end - (victim.end - victim.begin + 1) / 2;
+                end = victim.end;
+                victim.end = begin;
+            }
+            std::lock_guard lock(own.mutex);
+            own.begin = begin + 1;
+            own.end = end;
+            return begin;
+        }
+        return std::nullopt; // Whatever is still in flight was taken by a thread that will finish it
+    };
+
+    std::atomic<bool> failed = false;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    const auto work = [&](size_t t) {
+        while (!failed.load(std::memory_order_relaxed)) {
+            const std::optional<size_t> k = next(t);
+            if (!k) return;
+            try {
+                fn(*k);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t t = 1; t < threads; ++t) workers.emplace_back(work, t);
+    work(0);
+    for (std::thread &worker : workers) worker.join();
+    if (error) std::rethrow_exception(error);
+}
+} // namespace CONCURRENCY
@@ -4,6 +4,7 @@
 #include <chrono>
 #include <glm/glm.hpp>
 
+#include "chip8/chip8_constants.hpp"
 #include "types.hpp"
 
 using namespace std::chrono_literals;
@@ -17,18 +18,19 @@ inline constexpr float aspect_ratio = static_cast<float>(window_width) / window_
 inline constexpr float path_marker_width = 0.025f;
 inline constexpr float path_marker_height = 0.025f;
 
-inline constexpr uint16_t rom_program_start = 0x200;
-inline constexpr uint16_t rom_font_start = 0x050;
-
-inline constexpr size_t n_iter_per_frame = 700;
-inline constexpr auto timer_update_delay = 16'666'667ns; // 1 second / 60 in nanoseconds
-
 inline constexpr std::array<float, 12> square_vertices = {
     1.0f, -1.0f, 0.0f,
     1.0f, 0.0f, 0.0f,
     0.0f, 0.0f, 0.0f,
     0.0f, -1.0f, 0.0f};
 
+// Covers all of clip space, drawn with square_indices
+inline constexpr std::array<float, 12> fullscreen_quad_vertices = {
+    1.0f, -1.0f, 0.0f,
+    1.0f, 1.0f, 0.0f,
+    -1.0f, 1.0f, 0.0f,
+    -1.0f, -1.0f, 0.0f};
+
 inline constexpr std::array<unsigned int, 6> square_indices = {
     0, 1, 3,
     1, 2, 3};
@@ -81,37 +83,11 @@ inline constexpr int max_tower_level = 5;
 inline constexpr char const *fp_shader_dir = "assets/shaders/";
 inline constexpr char const *fp_vertex_shader = "assets/shaders/vertex.glsl";
 inline constexpr char const *fp_fragment_shader = "assets/shaders/fragment.glsl";
+inline constexpr char const *fp_blit_vertex_shader = "assets/shaders/blit_vertex.glsl";
+inline constexpr char const *fp_blit_fragment_shader = "assets/shaders/blit_fragment.glsl";
+inline constexpr char const *fp_phosphor_fragment_shader = "assets/shaders/phosphor_fragment.glsl";
 
 inline constexpr char const *fp_sound_beep = "assets/sound/beep.wav";
 
-inline constexpr std::array<const char *, 7> fp_code_test_suite = {
-    "assets/code/1-chip8-logo.ch8",
-    "assets/code/2-ibm-logo.ch8",
-    "assets/code/3-corax+.ch8",
-    "assets/code/4-flags.ch8",
-    "assets/code/5-quirks.ch8",
-    "assets/code/6-keypad.ch8",
-    "assets/code/7-beep.ch8"};
-inline constexpr char const *fp_code_ibm_logo = "assets/code/IBM Logo.ch8";
-// https://github.com/stianeklund/chip8
-inline constexpr char const *fp_code_pong = "assets/code/PONG.ch8";
-
-inline constexpr std::array<uint8_t, 5 * 16> fontdata{
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
+inline constexpr char const *fp_trace = "trace.json"; // Written on F9 and on exit
 } // namespace CONSTANTS
\ No newline at end of file
@@ -0,0 +1,333 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Runs a Chip8 on its own thread so rendering, vsync and input handling never stall it.
+
+The emulation thread owns the machine. It publishes a `Frame` snapshot after every completed
+emulated frame, and everything the UI wants to change goes through `send` as a `Command`.
+Every completed frame is also recorded into `rewind`, stepping back pauses emulation. While a movie
+is being recorded every input reaching the machine is logged to `movie` as well.
+
+An Emulator shares nothing with any other, a process can run as many machines side by side as it
+has cores for.
+*/
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "chip8/chip8.hpp"
+#include "chip8/chip8_movie.hpp"
+#include "chip8/chip8_profile.hpp"
+#include "chip8/chip8_rewind.hpp"
+#include "chip8/chip8_scheduler.hpp"
+#include "concurrency.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+
+namespace EMULATION {
+/* Everything the frontend displays, copied out of the machine so it can be read without locking. */
+struct Frame {
+    uint64_t sequence = 0; // Consecutive per publish, a gap means the reader skipped frames
+    CHIP8::Display display = {};
+    uint32_t dirty_rows = 0; // Rows that may differ from the frame published before this one
+    std::array<BYTE, 4 * 1024> mem = {};
+    WORD PC = 0;
+    WORD I = 0;
+    int stack_pointer = -1;
+    BYTE delay_timer = 0;
+    BYTE sound_timer = 0;
+    uint64_t iteration_counter = 0;
+    std::array<BYTE, 16> VX{};
+    std::array<bool, 16> keypad = {};
+    CHIP8::Dispatch dispatch = CHIP8::Dispatch::table;
+    bool fuse_superinstructions = false;
+    double instructions_per_second = 0.0;
+    CHIP8::TimerMode timer_mode = CHIP8::TimerMode::host;
+    uint32_t instructions_per_tick = 0;
+    uint64_t frames_completed = 0;
+    double time_dropped = 0.0; // Seconds
+    bool paused = false;
+    uint64_t rewind_frames = 0; // Retained frames, numbered rewind_oldest, rewind_oldest + 1, ...
+    uint64_t rewind_oldest = 0;
+    uint64_t rewind_cursor = 0; // Frame the machine is at
+    size_t rewind_bytes = 0;
+    size_t rewind_capacity = 0;
+    bool movie_recording = false;
+    size_t movie_inputs = 0;
+#if CHIP8_PROFILE
+    bool profiling = false;
+    uint64_t profiled = 0; // Instructions counted since the last reset
+    CHIP8::ProfileTop profile_ops{};
+    CHIP8::ProfileTop profile_pcs{};
+    CHIP8::ProfileTop profile_blocks{};
+#endif
+};
+
+enum class CommandKind {
+    key_down,      // a = key
+    key_up,        // a = key
+    toggle_pixel,  // a = x, b = y
+    set_dispatch,  // a = Dispatch
+    set_fuse,      // a = enabled
+    set_rate,      // value = instructions per second
+    set_timers,    // a = TimerMode, b = instructions per tick
+    set_paused,    // a = paused
+    step_back,     // Pauses and restores the frame before the current one
+    seek,          // Pauses and restores frame a
+    start_movie,   // Starts recording a movie from the current state
+    stop_movie,    // Stops recording and writes the movie to Emulator::movie_path
+    set_profiling, // a = enabled, CHIP8_PROFILE builds only
+    reset_profile, // CHIP8_PROFILE builds only
+    save_profile,  // Writes Emulator::profile_path + ".csv" / ".folded", CHIP8_PROFILE builds only
+};
+
+struct Command {
+    CommandKind kind;
+    int a = 0;
+    int b = 0;
+    double value = 0.0;
+};
+
+struct Emulator {
+    CHIP8::Chip8 *machine = nullptr;
+    CHIP8::Scheduler scheduler;
+    CONCURRENCY::TripleBuffer<Frame> frames;
+    CONCURRENCY::SpscQueue<Command, 256> commands;
+    std::atomic<bool> running = false;
+    std::thread thread;
+    uint64_t published = 0;
+    bool paused = false;
+    CHIP8::Rewind rewind;
+    CHIP8::MovieRecorder movie;
+    std::string movie_path = "movie.c8m"; // Where stop_movie writes, set before `start`
+    std::string profile_path = "profile";  // Without extension, where save_profile writes
+    BYTE published_delay_timer = 0;
+    BYTE published_sound_timer = 0;
+};
+
+/* Emulation thread only. */
+inline auto stop_movie(Emulator &e) -> void {
+    if (!e.movie.recording) return;
+    const CHIP8::Movie movie = CHIP8::stop_recording(e.movie, *e.machine);
+    try {
+        CHIP8::save_movie_to_file(movie, e.movie_path);
+        LOG_INFO("Saved movie with {} inputs to {}", movie.inputs.size(), e.movie_path);
+    } catch (const std::exception &ex) {
+        LOG_ERR("Saving movie failed: {}", ex.what());
+    }
+}
+
+/* Emulation thread only, shows a machine that was edited or restored from outside its inputs. */
+inline auto present_edited(Emulator &e) -> void {
+    // A movie can't replay edits, it ends where the machine still followed from its inputs
+    if (e.movie.recording) {
+        LOG_WARN("Machine state edited while recording, stopping the movie");
+        stop_movie(e);
+    }
+    e.scheduler.presented = e.machine->display;
+    e.scheduler.presented_dirty |= CHIP8::take_dirty_rows(*e.machine);
+}
+
+/* Emulation thread only. */
+inline auto save_profile([[maybe_unused]] Emulator &e) -> void {
+#if CHIP8_PROFILE
+    try {
+        CHIP8::save_profile_csv(*e.machine, e.profile_path + ".csv");
+        CHIP8::save_profile_folded(*e.machine, e.profile_path + ".folded");
+        LOG_INFO("Saved profile to {}.csv and {}.folded", e.profile_path, e.profile_path);
+    } catch (const std::exception &ex) {
+        LOG_ERR("Saving profile failed: {}", ex.what());
+    }
+#else
+    LOG_WARN("Profiling is not built in, configure with -DCHIP8_PROFILE=ON");
+#endif
+}
+
+/* Emulation thread only. */
+inline auto apply(Emulator &e, const Command &cmd) -> void {
+    CHIP8::Chip8 &c = *e.machine;
+    switch (cmd.kind) {
+    case CommandKind::key_down:
+        CHIP8::press_key(c, static_cast<BYTE>(cmd.a));
+        CHIP8::record_input(e.movie, c, CHIP8::MovieEvent::key_down, static_cast<BYTE>(cmd.a));
+        break;
+    case CommandKind::key_up:
+        CHIP8::release_key(c, static_cast<BYTE>(cmd.a));
+        CHIP8::record_input(e.movie, c, CHIP8::MovieEvent::key_up, static_cast<BYTE>(cmd.a));
+        break;
+    case CommandKind::toggle_pixel:
+        CHIP8::toggle_pixel(c, cmd.a, cmd.b);
+        present_edited(e);
+        break;
+    case CommandKind::set_dispatch:
+        c.dispatch = static_cast<CHIP8::Dispatch>(cmd.a);
+        break;
+    case CommandKind::set_fuse:
+        c.fuse_superinstructions = cmd.a != 0;
+        break;
+    case CommandKind::set_rate:
+        e.scheduler.instructions_per_second = cmd.value;
+        break;
+    case CommandKind::set_timers:
+        // Realtime is the Scheduler's job, the machine only picks between frame and instruction ticks
+        c.timer_mode = (cmd.a == static_cast<int>(CHIP8::TimerMode::instructions)) ? CHIP8::TimerMode::instructions
+                                                                                    : CHIP8::TimerMode::host;
+        c.instructions_per_tick = static_cast<uint32_t>(std::max(cmd.b, 1));
+        present_edited(e); // Movies don't record timer changes, replaying would tick differently
+        break;
+    case CommandKind::set_paused:
+        // Wall-clock time spent paused is not owed to the machine
+        if (e.paused && cmd.a == 0) e.scheduler.started = false;
+        e.paused = cmd.a != 0;
+        break;
+    case CommandKind::step_back:
+        e.paused = true;
+        if (e.rewind.step_back(c)) present_edited(e);
+        break;
+    case CommandKind::seek:
+        e.paused = true;
+        if (cmd.a >= 0 && e.rewind.seek(c, static_cast<uint64_t>(cmd.a))) present_edited(e);
+        break;
+    case CommandKind::start_movie:
+        stop_movie(e);
+        CHIP8::start_recording(e.movie, c);
+        LOG_INFO("Recording movie");
+        break;
+    case CommandKind::stop_movie:
+        stop_movie(e);
+        break;
+#if CHIP8_PROFILE
+    case CommandKind::set_profiling:
+        c.profiling = cmd.a != 0;
+        c.profile.next_pc = 0xFFFF; // Whatever ran unprofiled in between was no part of a counted block
+        break;
+    case CommandKind::reset_profile:
+        CHIP8::reset_profile(c);
+        break;
+#else
+    case CommandKind::set_profiling:
+    case CommandKind::reset_profile:
+        break;
+#endif
+    case CommandKind::save_profile:
+        save_profile(e);
+        break;
+    }
+}
+
+/* Emulation thread only. */
+inline auto publish(Emulator &e) -> void {
+    TRACE_SCOPE("publish");
+    const CHIP8::Chip8 &c = *e.machine;
+    Frame &f = e.frames.back();
+    f.sequence = ++e.published;
+    f.display = e.scheduler.presented;
+    f.dirty_rows = std::exchange(e.scheduler.presented_dirty, 0);
+    f.mem = c.mem;
+    f.PC = c.PC;
+    f.I = c.I;
+    f.stack_pointer = c.stack_pointer;
+    f.delay_timer = e.published_delay_timer = c.delay_timer;
+    f.sound_timer = e.published_sound_timer = c.sound_timer;
+    f.iteration_counter = c.iteration_counter;
+    f.VX = c.VX;
+    f.keypad = c.keypad;
+    f.dispatch = c.dispatch;
+    f.fuse_superinstructions = c.fuse_superinstructions;
+    f.instructions_per_second = e.scheduler.instructions_per_second;
+    f.timer_mode = c.timer_mode;
+    f.instructions_per_tick = c.instructions_per_tick;
+    f.frames_completed = e.scheduler.frames_completed;
+    f.time_dropped = e.scheduler.time_dropped.count();
+    f.paused = e.paused;
+    f.rewind_frames = e.rewind.empty() ? 0 : e.rewind.newest_frame() - e.rewind.oldest_frame() + 1;
+    f.rewind_oldest = e.rewind.oldest_frame();
+    f.rewind_cursor = e.rewind.cursor_frame();
+    f.rewind_bytes = e.rewind.bytes_used();
+    f.rewind_capacity = e.rewind.arena_bytes();
+    f.movie_recording = e.movie.recording;
+    f.movie_inputs = e.movie.movie.inputs.size();
+#if CHIP8_PROFILE
+    f.profiling = c.profiling;
+    f.profiled = 0;
+    for (const uint64_t n : c.profile.per_op) f.profiled += n;
+    f.profile_ops = CHIP8::top_counts(c.profile.per_op);
+    f.profile_pcs = CHIP8::top_counts(c.profile.per_pc);
+    f.profile_blocks = CHIP8::top_counts(c.profile.per_block);
+#endif
+    e.frames.publish();
+}
+
+/*
+Emulation thread only. After frames in which the machine executed nothing, e.g. while it waits on
+FX0A, only the timers and the display can differ from what was last published.
+*/
+inline auto idle_frames_changed(const Emulator &e) -> bool {
+    const CHIP8::Chip8 &c = *e.machine;
+    return e.scheduler.presented_dirty != 0 || c.delay_timer != e.published_delay_timer ||
+           c.sound_timer != e.published_sound_timer;
+}
+
+inline auto run(Emulator &e) -> void {
+    CHIP8::Chip8 &c = *e.machine;
+    TRACE::set_thread_name("emulation");
+    while (e.running.load(std::memory_order_relaxed)) {
+        bool changed = false;
+        while (const auto cmd = e.commands.pop()) {
+            TRACE_SCOPE("apply");
+            apply(e, *cmd);
+            changed = true;
+        }
+        bool idle = true;
+        const auto record = [&e, &idle](const CHIP8::Chip8 &m) {
+            e.rewind.record(m);
+            CHIP8::record_input(e.movie, m, CHIP8::MovieEvent::frame);
+            idle = idle && m.idle;
+        };
+        if (!e.paused) {
+            TRACE_SCOPE("advance");
+            if (CHIP8::advance(e.scheduler, c, CHIP8::Scheduler::clock::now(), record) > 0) {
+                // A waiting machine has nothing new to show, so no snapshot is copied
+                changed = changed || !idle || idle_frames_changed(e);
+            }
+        }
+        if (changed) publish(e);
+
+        // Nothing to do until the next emulated frame is due
+        const auto until_next = CHIP8::emulated_frame_time - e.scheduler.accumulator;
+        std::this_thread::sleep_for(std::chrono::duration_cast<std::chrono::nanoseconds>(until_next));
+    }
+}
+
+/* Hands `c` to a new emulation thread, it must not be touched from anywhere else until `stop`. */
+inline auto start(Emulator &e, CHIP8::Chip8 &c) -> void {
+    e.machine = &c;
+    CHIP8::attach(e.scheduler, c);
+    e.rewind.clear();
+    e.rewind.record(c);
+    publish(e);
+    e.running = true;
+    e.thread = std::thread(run, std::ref(e));
+    LOG_INFO("Emulation thread started");
+}
+
+inline auto stop(Emulator &e) -> void {
+    e.running = false;
+    if (e.thread.joinable()) e.thread.join();
+    stop_movie(e);
+    LOG_INFO("Emulation thread stopped");
+}
+
+/* Frontend thread only. */
+inline auto send(Emulator &e, const Command &cmd) -> void {
+    if (!e.commands.push(cmd)) LOG_WARN("Emulation command queue full, dropping command");
+}
+inline auto latest_frame(Emulator &e) -> const Frame & { return e.frames.read(); }
+} // namespace EMULATION
@@ -4,10 +4,12 @@
 #include <fstream>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <initializer_list>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "log.hpp"
 #include "types.hpp"
@@ -33,6 +35,10 @@ public:
     }
     static auto unbind() -> void { glUseProgram(GL_ZERO); }
 
+    auto set_uniform(const std::string &name, int value) const -> void {
+        glUniform1i(get_uniform(name), value);
+    }
+
     auto set_uniform(const std::string &name, float value) const -> void {
         glUniform1f(get_uniform(name), value);
     }
@@ -66,6 +72,19 @@ public:
         glDeleteShader(vert);
         glDeleteShader(frag);
 
+        // Uniforms the compiler optimised away are absent, setting one of those is an error
+        m_uniforms.clear();
+        GLint uniform_count = 0;
+        glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &uniform_count);
+        for (GLint i = 0; i < uniform_count; ++i) {
+            char name[128];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(m_id, static_cast<GLuint>(i), sizeof(name), &length, &size, &type, name);
+            m_uniforms[std::string(name, length)] = glGetUniformLocation(m_id, name);
+        }
+
         LOG_INFO(std::string("Shader program loaded: ") + vertex_path + " / " + fragment_path);
     }
 
@@ -140,6 +159,39 @@ template <size_t VertexCount, size_t IndexCount>
     return gb;
 }
 
+/* Single-level 2D texture with nearest filtering, for pixel-exact display data. */
+[[nodiscard]] inline auto create_texture(GLsizei width, GLsizei height, GLint internal_format, GLenum format) -> GLuint {
+    GLuint texture = GL_ZERO;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, GL_ZERO);
+    return texture;
+}
+
+/* Framebuffer rendering into `color_textures`, bound to fragment outputs 0, 1, ... in order. */
+[[nodiscard]] inline auto create_framebuffer(std::initializer_list<GLuint> color_textures) -> GLuint {
+    GLuint fbo = GL_ZERO;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    std::vector<GLenum> draw_buffers;
+    for (GLuint texture : color_textures) {
+        const GLenum attachment = GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(draw_buffers.size());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+        draw_buffers.push_back(attachment);
+    }
+    glDrawBuffers(static_cast<GLsizei>(draw_buffers.size()), draw_buffers.data());
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        PANIC("Framebuffer incomplete");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, GL_ZERO);
+    return fbo;
+}
+
 inline auto set_box_uniforms(const ShaderProgram &sp, const Rect &box) -> void {
     sp.set_uniform("u_Pos", vec2{box.position.x, box.position.y});
     sp.set_uniform("u_Width", box.width);
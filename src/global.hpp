@@ -1,16 +1,40 @@
 #pragma once
 
 #include <SDL.h>
+#include <array>
 #include <chrono>
 #include <imgui.h>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "chip8/chip8.hpp"
+#include "chip8/chip8_display.hpp"
 #include "constants.hpp"
+#include "emulation.hpp"
 #include "gl.hpp"
 #include "types.hpp"
 
 using TYPES::Color;
 using TYPES::Position;
 
+/* One machine's display on the GPU, every hosted machine has its own. */
+struct DisplayTextures {
+    GLuint chip8_texture = 0;                    // R8, one texel per CHIP-8 pixel
+    GLuint display_texture = 0;                  // RGBA8, what the machine's window shows
+    GLuint display_fbo = 0;
+    std::array<GLuint, 2> phosphor_history = {}; // R16F intensity per pixel, ping-ponged
+    std::array<GLuint, 2> phosphor_fbos = {};    // display_texture + phosphor_history[i]
+    int history_index = 0;                       // phosphor_history[history_index] is the latest
+    uint64_t blitted_frames = 0;                 // Frame::frames_completed at the last pass
+    int fade_frames_left = 0;                    // Emulated frames until the afterglow is fully gone
+    bool phosphor_enabled = false;               // Settings the passes ran with
+    float phosphor_decay = 0.0f;
+    uint64_t uploaded_sequence = 0; // Frame::sequence chip8_texture holds, 0 = nothing uploaded yet
+    Color blitted_on = {};          // Palette display_texture was last drawn with
+    Color blitted_off = {};
+};
+
 struct RendererState {
     SDL_Window *window = nullptr;
     SDL_GLContext gl_context = nullptr;
@@ -21,8 +45,8 @@ struct RendererState {
     GL::GeometryBuffers geom_triangle;
 
     GL::GeometryBuffers blit_quad;
-    GLuint chip8_texture = 0;
-    GL::ShaderProgram blit_shader;
+    GL::ShaderProgram blit_shader;     // DisplayTextures::chip8_texture -> display_texture in palette colors
+    GL::ShaderProgram phosphor_shader; // Like blit_shader, plus decaying afterglow
 
     int gl_success;
     char gl_error_buffer[512];
@@ -44,6 +68,7 @@ struct SimulationState {
 
 struct InputState {
     Position mouse_pos;
+    std::array<bool, 16> keys_held = {}; // CHIP-8 keys held on the keyboard, all sent to the active machine
 };
 
 struct ColorPalette {
@@ -52,17 +77,35 @@ struct ColorPalette {
     Color pixel_off = Color{0.0f, 0.0f, 0.0f};
 };
 
+struct PhosphorSettings {
+    bool enabled = true;
+    float decay = 0.55f; // Intensity an unlit pixel keeps per emulated frame, hides XOR flicker
+};
+
 struct AudioState {
     Mix_Chunk *beep_sound = nullptr;
     bool is_beep_playing = false;
 };
 
+/* A machine the frontend hosts, each runs on its own emulation thread. */
+struct Machine {
+    std::string name; // ROM file name
+    std::unique_ptr<CHIP8::Chip8> chip8;
+    std::unique_ptr<EMULATION::Emulator> emulator;
+    DisplayTextures display;
+};
+
 struct Global {
     bool is_running = false;
     RendererState renderer;
     SimulationState sim;
     InputState input;
     ColorPalette color;
+    PhosphorSettings phosphor;
     AudioState audio;
+    std::vector<Machine> machines;
+    size_t active = 0; // Machine that gets keyboard input and audio and is shown in the Chip8 window
 };
-inline Global global;
\ No newline at end of file
+inline Global global;
+
+inline auto active_machine() -> Machine & { return global.machines[global.active]; }
@@ -3,14 +3,16 @@
 
 #include "chip8/chip8.hpp"
 #include "constants.hpp"
+#include "emulation.hpp"
+#include "global.hpp"
 #include "log.hpp"
+#include "trace.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
 #include "backends/imgui_impl_sdl.h"
 #include <SDL.h>
 
-using CHIP8::chip8;
 // TODO: Seperate the CHIP8 specific input to the chip8 module
 
 namespace INPUT {
@@ -22,6 +24,17 @@ inline auto update_mouse_position() -> void {
         static_cast<float>(mouse_y) / CONSTANTS::window_height};
 }
 
+/* Makes machine `index` the one keyboard input goes to, keys held down are released on the old one. */
+inline auto select_machine(size_t index) -> void {
+    if (index == global.active) return;
+    for (int key = 0; key < 16; ++key) {
+        if (!global.input.keys_held[key]) continue;
+        EMULATION::send(*active_machine().emulator, {EMULATION::CommandKind::key_up, key});
+        global.input.keys_held[key] = false;
+    }
+    global.active = index;
+}
+
 // clang-format off
 std::optional<int> map_sdl_key_to_chip8(SDL_Keycode key) {
     switch (key) {
@@ -59,14 +72,21 @@ inline auto handle_event(const SDL_Event &event) -> void {
     case SDL_KEYUP: {
         bool is_down = (event.type == SDL_KEYDOWN);
         auto chip8_key = map_sdl_key_to_chip8(event.key.keysym.sym);
-        if (chip8_key) {
-            int key = *chip8_key;
+        EMULATION::Emulator &emulator = *active_machine().emulator;
+        // A key released after switching machines was already released on the old one
+        if (chip8_key && !event.key.repeat && global.input.keys_held[*chip8_key] != is_down) {
+            using EMULATION::CommandKind;
+            EMULATION::send(emulator, {is_down ? CommandKind::key_down : CommandKind::key_up, *chip8_key});
+            global.input.keys_held[*chip8_key] = is_down;
+        }
 
-            if (is_down && !chip8.keypad[key]) {
-                chip8.just_pressed[key] = true;
-            }
+        // Held down, key repeat keeps stepping further back
+        if (event.key.keysym.sym == SDLK_BACKSPACE && is_down) {
+            EMULATION::send(emulator, {EMULATION::CommandKind::step_back});
+        }
 
-            chip8.keypad[key] = is_down;
+        if (event.key.keysym.sym == SDLK_F9 && is_down && !event.key.repeat) {
+            TRACE::save_chrome_trace(CONSTANTS::fp_trace);
         }
 
         if (event.key.keysym.sym == SDLK_ESCAPE && is_down) {
@@ -87,7 +107,6 @@ inline auto handle_event(const SDL_Event &event) -> void {
 
 inline auto handle_input() -> void {
     update_mouse_position();
-    std::fill(std::begin(chip8.just_pressed), std::end(chip8.just_pressed), false);
 
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
@@ -1,22 +1,131 @@
 #pragma once
 
+/*
+Logging goes through a preallocated lock-free ring: LOG_* copies the static format string pointer and
+the arguments into a slot (strings inline, everything else as a plain copy), and a background
+thread formats and writes them. Logging from a hot thread costs a copy and never allocates or
+touches stdout. When the ring is full messages are dropped and counted instead of waiting.
+
+Levels below LOG_COMPILED_LEVEL compile to nothing, levels below `LOGGING::level` are skipped at
+runtime.
+*/
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <format>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <source_location>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+#include "concurrency.hpp"
 
 enum class LogLevel {
+    Debug,
     Info,
     Warn,
     Error
 };
 
-template <typename... Args>
-inline void log(LogLevel level, std::string_view fmt, Args &&...args) {
-    std::string msg = std::vformat(fmt, std::make_format_args(args...));
-    switch (level) {
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 0 // Lowest LogLevel, as an int, that is compiled in
+#endif
+
+namespace LOGGING {
+inline constexpr size_t ring_capacity = 4 * 1024; // Messages in flight
+inline constexpr size_t arg_bytes = 224;          // Per message, longer ones are written synchronously
+
+inline std::atomic<LogLevel> level = LogLevel::Info;
+
+/* Copied as a length and its characters, everything else must be trivially copyable. */
+template <typename T>
+concept LogString = std::convertible_to<const T &, std::string_view>;
+
+template <typename T>
+using Stored = std::conditional_t<LogString<T>, std::string_view, T>;
+
+template <typename T>
+inline constexpr size_t fixed_bytes = LogString<T> ? sizeof(uint16_t) : sizeof(T);
+
+template <typename T>
+inline auto encoded_size(const T &value) -> size_t {
+    if constexpr (LogString<T>) {
+        return sizeof(uint16_t) + std::string_view(value).size();
+    } else {
+        return sizeof(T);
+    }
+}
+
+template <typename T>
+inline auto encode(std::byte *&out, const T &value) -> void {
+    if constexpr (LogString<T>) {
+        const std::string_view s(value);
+        const auto n = static_cast<uint16_t>(s.size());
+        std::memcpy(out, &n, sizeof n);
+        std::memcpy(out + sizeof n, s.data(), n);
+        out += sizeof n + n;
+    } else {
+        static_assert(std::is_trivially_copyable_v<T>, "Log arguments must be strings or trivially copyable");
+        std::memcpy(out, &value, sizeof(T));
+        out += sizeof(T);
+    }
+}
+
+template <typename S>
+inline auto decode(const std::byte *&in) -> S {
+    if constexpr (std::same_as<S, std::string_view>) {
+        uint16_t n;
+        std::memcpy(&n, in, sizeof n);
+        const std::string_view s(reinterpret_cast<const char *>(in + sizeof n), n);
+        in += sizeof n + n;
+        return s;
+    } else {
+        std::array<std::byte, sizeof(S)> raw;
+        std::memcpy(raw.data(), in, sizeof(S));
+        in += sizeof(S);
+        return std::bit_cast<S>(raw);
+    }
+}
+
+/* Instantiated per argument list, turns the bytes `encode` wrote back into a formatted message. */
+template <typename... S>
+inline auto format_args(std::string &out, const char *fmt, const std::byte *args) -> void {
+    [[maybe_unused]] const std::byte *in = args; // Unread when there are no arguments
+    const std::tuple<S...> values{decode<S>(in)...}; // Braced, so decoded left to right
+    std::apply([&](const S &...v) { std::vformat_to(std::back_inserter(out), fmt, std::make_format_args(v...)); },
+        values);
+}
+
+struct Record {
+    LogLevel level = LogLevel::Info;
+    const char *fmt = nullptr;
+    void (*format)(std::string &out, const char *fmt, const std::byte *args) = nullptr;
+    std::array<std::byte, arg_bytes> args;
+};
+
+inline std::mutex write_mutex; // Keeps the writer thread and synchronous writes from interleaving
+
+inline auto write_line(LogLevel lvl, std::string_view msg) -> void {
+    const std::lock_guard lock(write_mutex);
+    switch (lvl) {
+    case LogLevel::Debug:
+        std::cout << "[DEBUG] " << msg << "\n";
+        break;
     case LogLevel::Info:
         std::cout << "[INFO] " << msg << "\n";
         break;
@@ -29,19 +138,156 @@ inline void log(LogLevel level, std::string_view fmt, Args &&...args) {
     }
 }
 
-template <
-    typename T,
-    typename = std::enable_if_t<!std::is_convertible_v<T, std::string_view>>>
-inline void log(LogLevel level, T &&value) {
-    log(level, "{}", std::forward<T>(value));
+/* Set once the logger is destroyed at exit, anything logged after that is written synchronously. */
+inline std::atomic<bool> shut_down = false;
+
+/*
+Bounded multi-producer queue of Records with one consumer, the writer thread. Every slot carries a
+sequence number saying whose turn it is: `pos` when free for the producer claiming position `pos`,
+`pos + 1` once that producer has filled it.
+*/
+class Logger {
+public:
+    Logger() : m_slots(std::make_unique<Slot[]>(ring_capacity)) {
+        for (size_t k = 0; k < ring_capacity; ++k) m_slots[k].sequence.store(k, std::memory_order_relaxed);
+        m_thread = std::thread([this] { run(); });
+    }
+    ~Logger() {
+        m_running.store(false, std::memory_order_release);
+        m_thread.join();
+        shut_down.store(true, std::memory_order_release);
+    }
+    Logger(const Logger &) = delete;
+    auto operator=(const Logger &) -> Logger & = delete;
+
+    /* Any thread, false if the ring is full. */
+    template <typename... Args>
+    auto push(LogLevel lvl, const char *fmt, const Args &...args) -> bool {
+        size_t pos = m_enqueue.load(std::memory_order_relaxed);
+        while (true) {
+            Slot &slot = m_slots[pos % ring_capacity];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == pos) {
+                if (!m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) continue;
+                slot.record.level = lvl;
+                slot.record.fmt = fmt;
+                slot.record.format = &format_args<Stored<Args>...>;
+                [[maybe_unused]] std::byte *out = slot.record.args.data(); // Unwritten when there are no arguments
+                (encode(out, args), ...);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+            if (sequence < pos) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            pos = m_enqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    /* Waits until everything pushed before the call is written. */
+    auto flush() -> void {
+        const size_t target = m_enqueue.load(std::memory_order_acquire);
+        while (m_dequeue.load(std::memory_order_acquire) < target) std::this_thread::yield();
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    auto run() -> void {
+        using namespace std::chrono_literals;
+        std::string line;
+        while (true) {
+            const bool running = m_running.load(std::memory_order_acquire);
+            drain(line);
+            if (!running) return; // Drained once more after the last push
+            std::this_thread::sleep_for(1ms);
+        }
+    }
+
+    auto drain(std::string &line) -> void {
+        size_t pos = m_dequeue.load(std::memory_order_relaxed);
+        bool wrote = false;
+        for (;; ++pos) {
+            Slot &slot = m_slots[pos % ring_capacity];
+            if (slot.sequence.load(std::memory_order_acquire) != pos + 1) break;
+            line.clear();
+            try {
+                slot.record.format(line, slot.record.fmt, slot.record.args.data());
+                write_line(slot.record.level, line);
+            } catch (const std::exception &ex) {
+                write_line(LogLevel::Error, std::format("Bad log format \"{}\": {}", slot.record.fmt, ex.what()));
+            }
+            slot.sequence.store(pos + ring_capacity, std::memory_order_release);
+            m_dequeue.store(pos + 1, std::memory_order_release);
+            wrote = true;
+        }
+        if (const uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed)) {
+            write_line(LogLevel::Warn, std::format("Log ring full, dropped {} message(s)", dropped));
+        }
+        if (wrote) std::cout.flush();
+    }
+
+    std::unique_ptr<Slot[]> m_slots;
+    alignas(CONCURRENCY::cache_line) std::atomic<size_t> m_enqueue{0};
+    alignas(CONCURRENCY::cache_line) std::atomic<size_t> m_dequeue{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<bool> m_running{true};
+    std::thread m_thread;
+};
+
+/* Started by the first message logged, drained and stopped at exit. */
+inline auto logger() -> Logger & {
+    static Logger l;
+    return l;
 }
 
-#define LOG_INFO(fmt, ...) log(LogLevel::Info, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...) log(LogLevel::Warn, fmt, ##__VA_ARGS__)
-#define LOG_ERR(fmt, ...) log(LogLevel::Error, fmt, ##__VA_ARGS__)
+inline auto flush() -> void {
+    if (!shut_down.load(std::memory_order_acquire)) logger().flush();
+}
+
+template <LogLevel Level, size_t N, typename... Args>
+inline auto log(const char (&fmt)[N], const Args &...args) -> void {
+    if constexpr (static_cast<int>(Level) >= LOG_COMPILED_LEVEL) {
+        if (Level < level.load(std::memory_order_relaxed)) return;
+        static_assert((fixed_bytes<Args> + ... + 0) <= arg_bytes, "Too many log arguments for one message");
+        const size_t size = (encoded_size(args) + ... + 0);
+        if (size <= arg_bytes && !shut_down.load(std::memory_order_acquire)) {
+            logger().push(Level, fmt, args...);
+            return;
+        }
+        // Too long to queue, written in order after everything already queued
+        flush();
+        write_line(Level, std::vformat(fmt, std::make_format_args(args...)));
+    }
+}
+
+/* A message built at runtime, e.g. LOG_ERR("Failed: " + reason). */
+template <LogLevel Level, typename T>
+    requires(!std::is_array_v<std::remove_cvref_t<T>>)
+inline auto log(const T &value) -> void {
+    log<Level>("{}", value);
+}
+} // namespace LOGGING
+
+#define LOG_DEBUG(fmt, ...) LOGGING::log<LogLevel::Debug>(fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOGGING::log<LogLevel::Info>(fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOGGING::log<LogLevel::Warn>(fmt, ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...) LOGGING::log<LogLevel::Error>(fmt, ##__VA_ARGS__)
+
+/* Thrown by PANIC instead of exiting on threads that set `panic_throws`. */
+struct Panic : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/* Lets a thread running many independent machines (e.g. a batch runner) survive one that panics. */
+inline thread_local bool panic_throws = false;
 
 /**
- * panic_impl: prints an error and aborts.
+ * panic_impl: prints an error and aborts, or throws Panic if `panic_throws` is set.
  * - msg defaults to empty if not provided.
  * - loc defaults to the *call-site* source_location.
  */
@@ -58,8 +304,11 @@ panic_impl(
             loc.file_name(), loc.line());
     }
 
+    if (panic_throws) throw Panic(full);
+
     // Log it and abort
     LOG_ERR("{}", full);
+    LOGGING::flush();
     std::exit(EXIT_FAILURE);
 }
 
@@ -74,4 +323,4 @@ panic_impl(
 
 #undef PANIC_UNDEFINED
 #define PANIC_UNDEFINED(opcode) \
-    panic_impl(std::format("Undefined instruction: {:#06x}", opcode))
\ No newline at end of file
+    panic_impl(std::format("Undefined instruction: {:#06x}", opcode))
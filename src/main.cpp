@@ -14,8 +14,10 @@
 #include <bitset>
 #include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <format>
 #include <iostream>
+#include <memory>
 #include <thread>
 
 using std::chrono::steady_clock;
@@ -24,55 +26,95 @@ using namespace std::chrono_literals;
 // Project headers
 #include "audio.hpp"
 #include "chip8/chip8.hpp"
-#include "chip8/chip8_examples.hpp"
 #include "chip8/chip8_types.hpp"
 #include "constants.hpp"
+#include "emulation.hpp"
 #include "engine.hpp"
 #include "gl.hpp"
 #include "global.hpp"
 #include "input.hpp"
 #include "log.hpp"
 #include "render.hpp"
+#include "trace.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
-using CHIP8::chip8;
-
-auto main() -> int {
-    CHIP8::initialise(chip8);
-    CHIP8::EXAMPLES::test_suite(chip8, 0);
-
+/* Loads `rom` into a new machine, which starts running on its own emulation thread right away. */
+auto add_machine(const std::filesystem::path &rom) -> void {
+    Machine &m = global.machines.emplace_back();
+    m.name = rom.filename().string();
+    m.chip8 = std::make_unique<CHIP8::Chip8>();
+    m.emulator = std::make_unique<EMULATION::Emulator>();
+    m.emulator->movie_path = std::format("movie-{}.c8m", global.machines.size() - 1);
+    CHIP8::initialise(*m.chip8);
+    CHIP8::load_program_from_file(*m.chip8, rom);
+    RENDER::create_display(m.display);
+    EMULATION::start(*m.emulator, *m.chip8);
+}
+
+/* Every ROM given on the command line runs in a machine of its own, side by side. */
+auto main(int argc, char **argv) -> int {
     LOG_INFO("Application starting");
+    TRACE::set_thread_name("frontend");
 
     if (!ENGINE::setup()) PANIC("Setup failed!");
     LOG_INFO("Engine setup complete");
+    RENDER::setup_display();
 
     global.is_running = true;
     global.sim.run_start_time = std::chrono::steady_clock::now();
     global.sim.frame_start_time = global.sim.run_start_time;
-    constexpr std::chrono::milliseconds instruction_interval{250};
-
-    auto last_instruction_time = std::chrono::steady_clock::now();
-    LOG_INFO("Entering main loop");
+    for (int i = 1; i < argc; ++i) {
+        try {
+            add_machine(argv[i]);
+        } catch (const std::exception &e) {
+            LOG_ERR("Skipping {}: {}", argv[i], e.what());
+            global.machines.pop_back();
+        }
+    }
+    if (global.machines.empty()) add_machine(CONSTANTS::fp_code_test_suite.at(0));
+    LOG_INFO("Entering main loop with {} machine(s)", global.machines.size());
     while (global.is_running) {
         auto now = std::chrono::steady_clock::now();
         global.sim.delta_time = now - global.sim.frame_start_time;
         global.sim.frame_start_time = now;
         global.sim.total_runtime = now - global.sim.run_start_time;
 
-        CHIP8::step(chip8, 1);
-
-        INPUT::handle_input();
-        RENDER::gui_debug();
-        RENDER::frame();
-
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        SDL_GL_SwapWindow(global.renderer.window);
+        TRACE_SCOPE("loop");
+        Audio::updateBeep(EMULATION::latest_frame(*active_machine().emulator).sound_timer > 0);
+
+        {
+            TRACE_SCOPE("handle_input");
+            INPUT::handle_input();
+        }
+        {
+            TRACE_SCOPE("gui_debug");
+            RENDER::gui_debug();
+        }
+        {
+            TRACE_SCOPE("frame");
+            RENDER::frame();
+        }
+        {
+            TRACE_SCOPE("imgui_render");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+        {
+            // Blocks on vsync
+            TRACE_SCOPE("swap_window");
+            SDL_GL_SwapWindow(global.renderer.window);
+        }
 
         global.sim.frame_counter += 1;
     }
 
     LOG_INFO("Main loop exited");
+    for (Machine &m : global.machines) {
+        EMULATION::stop(*m.emulator);
+        RENDER::destroy_display(m.display);
+    }
+    TRACE::save_chrome_trace(CONSTANTS::fp_trace);
+    RENDER::cleanup_display();
     ENGINE::cleanup();
     LOG_INFO("Engine cleanup complete");
     LOG_INFO("Application exiting successfully");
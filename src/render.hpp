@@ -6,40 +6,223 @@
 #include "imgui.h"
 #include <glad/glad.h>
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <string>
+
 #include "chip8/chip8.hpp"
+#include "emulation.hpp"
 #include "global.hpp"
+#include "input.hpp"
 #include "utils.hpp"
 
-using CHIP8::chip8;
+using EMULATION::CommandKind;
 
 namespace RENDER {
-inline auto display_grid() -> void {
-    constexpr int pixel_size = 10;
+/* Shared by every machine's display. */
+inline auto setup_display() -> void {
+    auto &r = global.renderer;
+    r.blit_quad = GL::create_geometry(CONSTANTS::fullscreen_quad_vertices, CONSTANTS::square_indices);
+    r.blit_shader.load(CONSTANTS::fp_blit_vertex_shader, CONSTANTS::fp_blit_fragment_shader);
+    r.phosphor_shader.load(CONSTANTS::fp_blit_vertex_shader, CONSTANTS::fp_phosphor_fragment_shader);
+}
 
-    ImGui::Begin("Chip8");
-    { // Pixel Buffer
-        ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-        for (int y = 0; y < 32; ++y) {
-            for (int x = 0; x < 64; ++x) {
-                Color c = chip8.display[y][x]
-                              ? global.color.pixel_on
-                              : global.color.pixel_off;
-                ImVec4 color{c.r, c.g, c.b, 1.0f};
-
-                ImGui::PushStyleColor(ImGuiCol_Button, color);
-                ImGui::PushStyleColor(ImGuiCol_ButtonHovered, color);
-                ImGui::PushStyleColor(ImGuiCol_ButtonActive, color);
-
-                std::string id = "##px_" + std::to_string(y) + "_" + std::to_string(x);
-                if (ImGui::Button(id.c_str(), ImVec2(pixel_size, pixel_size))) {
-                    chip8.display[y][x] ^= 1;
-                }
-
-                ImGui::PopStyleColor(3);
-                if (x < 63) ImGui::SameLine();
+inline auto cleanup_display() -> void {
+    auto &r = global.renderer;
+    glDeleteProgram(r.phosphor_shader.m_id);
+    glDeleteProgram(r.blit_shader.m_id);
+}
+
+inline auto create_display(DisplayTextures &d) -> void {
+    d = DisplayTextures{}; // Nothing uploaded yet, phosphor history cleared on the first pass
+    d.chip8_texture = GL::create_texture(CHIP8::display_width, CHIP8::display_height, GL_R8, GL_RED);
+    d.display_texture = GL::create_texture(CHIP8::display_width, CHIP8::display_height, GL_RGBA8, GL_RGBA);
+    d.display_fbo = GL::create_framebuffer({d.display_texture});
+    for (size_t i = 0; i < d.phosphor_history.size(); ++i) {
+        d.phosphor_history[i] = GL::create_texture(CHIP8::display_width, CHIP8::display_height, GL_R16F, GL_RED);
+        d.phosphor_fbos[i] = GL::create_framebuffer({d.display_texture, d.phosphor_history[i]});
+    }
+}
+
+inline auto destroy_display(DisplayTextures &d) -> void {
+    glDeleteFramebuffers(1, &d.display_fbo);
+    glDeleteFramebuffers(static_cast<GLsizei>(d.phosphor_fbos.size()), d.phosphor_fbos.data());
+    glDeleteTextures(static_cast<GLsizei>(d.phosphor_history.size()), d.phosphor_history.data());
+    glDeleteTextures(1, &d.display_texture);
+    glDeleteTextures(1, &d.chip8_texture);
+}
+
+/* Emulated frames until an unlit pixel's afterglow drops below one 8-bit color step. */
+inline auto phosphor_fade_frames(float decay) -> int {
+    if (decay <= 0.0f) return 1;
+    return static_cast<int>(std::ceil(std::log(1.0f / 255.0f) / std::log(std::min(decay, 0.99f))));
+}
+
+inline auto draw_display_pass(const DisplayTextures &d, const GL::ShaderProgram &shader, GLuint fbo) -> void {
+    auto &r = global.renderer;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, CHIP8::display_width, CHIP8::display_height);
+    glDisable(GL_BLEND);
+
+    shader.bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, d.chip8_texture);
+    shader.set_uniform("u_Display", 0);
+    shader.set_uniform("u_PixelOn", TYPES::color_to_vec3(global.color.pixel_on));
+    shader.set_uniform("u_PixelOff", TYPES::color_to_vec3(global.color.pixel_off));
+    GL::draw_simple_vao(r.blit_quad, static_cast<GLsizei>(CONSTANTS::square_indices.size()));
+    GL::ShaderProgram::unbind();
+
+    glEnable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, GL_ZERO);
+}
+
+/*
+Uploads only the span of rows that changed since the last frame and redraws display_texture.
+Skipped when neither the display, the palette nor a fading afterglow changed anything.
+Any skipped frame forces a full upload.
+*/
+inline auto update_display_texture(DisplayTextures &r, const EMULATION::Frame &f) -> void {
+    const PhosphorSettings &phosphor = global.phosphor;
+    const bool palette_changed = std::memcmp(&r.blitted_on, &global.color.pixel_on, sizeof(Color)) != 0 ||
+                                 std::memcmp(&r.blitted_off, &global.color.pixel_off, sizeof(Color)) != 0;
+    const bool phosphor_changed = phosphor.enabled != r.phosphor_enabled || phosphor.decay != r.phosphor_decay;
+    const uint64_t elapsed = f.frames_completed - r.blitted_frames;
+    const bool fading = phosphor.enabled && elapsed > 0 && r.fade_frames_left > 0;
+
+    uint32_t rows = 0;
+    if (f.sequence != r.uploaded_sequence) {
+        const bool consecutive = r.uploaded_sequence != 0 && f.sequence == r.uploaded_sequence + 1;
+        rows = consecutive ? f.dirty_rows : ~uint32_t{0};
+        r.uploaded_sequence = f.sequence;
+    }
+    if (rows == 0 && !palette_changed && !phosphor_changed && !fading) return;
+
+    if (rows != 0) {
+        const int first = std::countr_zero(rows);
+        const int count = CHIP8::display_height - std::countl_zero(rows) - first;
+        const CHIP8::ByteDisplay pixels = CHIP8::expand_display(f.display);
+        glBindTexture(GL_TEXTURE_2D, r.chip8_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, CHIP8::display_width, count,
+            GL_RED, GL_UNSIGNED_BYTE, pixels[first].data());
+    }
+    r.blitted_on = global.color.pixel_on;
+    r.blitted_off = global.color.pixel_off;
+
+    if (!phosphor.enabled) {
+        r.phosphor_enabled = false;
+        draw_display_pass(r, global.renderer.blit_shader, r.display_fbo);
+        return;
+    }
+
+    if (!r.phosphor_enabled) { // Stale afterglow from before it was switched off
+        constexpr GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (GLuint fbo : r.phosphor_fbos) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glClearBufferfv(GL_COLOR, 1, zero);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, GL_ZERO);
+    }
+    r.phosphor_enabled = true;
+    r.phosphor_decay = phosphor.decay;
+    if (rows != 0) {
+        r.fade_frames_left = phosphor_fade_frames(phosphor.decay);
+    } else {
+        r.fade_frames_left -= static_cast<int>(std::min<uint64_t>(elapsed, r.fade_frames_left));
+    }
+    r.blitted_frames = f.frames_completed;
+
+    // Reads the latest history, writes the color plus the new history into the other one
+    const GL::ShaderProgram &shader = global.renderer.phosphor_shader;
+    const int write = 1 - r.history_index;
+    shader.bind();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, r.phosphor_history[r.history_index]);
+    shader.set_uniform("u_History", 1);
+    shader.set_uniform("u_Decay", std::pow(phosphor.decay, static_cast<float>(elapsed)));
+    draw_display_pass(r, shader, r.phosphor_fbos[write]);
+    glActiveTexture(GL_TEXTURE0);
+    r.history_index = write;
+}
+
+/* One window per machine, laid out as a grid on first use. Focusing a window makes its machine active. */
+inline auto display_window(Machine &m, size_t index) -> void {
+    const size_t columns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(global.machines.size()))));
+    const int pixel_size = std::max(2, 10 / static_cast<int>(columns));
+    const ImVec2 size(CHIP8::display_width * pixel_size, CHIP8::display_height * pixel_size);
+    constexpr float margin = 20.0f;
+    ImGui::SetNextWindowPos(ImVec2(margin + (index % columns) * (size.x + margin),
+                                margin + (index / columns) * (size.y + 2 * margin)),
+        ImGuiCond_FirstUseEver);
+
+    const std::string title = std::format("{}##machine{}", m.name, index);
+    ImGui::Begin(title.c_str());
+    if (ImGui::IsWindowFocused(ImGuiFocusedFlags_RootAndChildWindows)) INPUT::select_machine(index);
+    ImGui::Image(reinterpret_cast<ImTextureID>(static_cast<intptr_t>(m.display.display_texture)), size);
+
+    // Click-to-toggle, hit-tested against the image rect
+    if (ImGui::IsItemHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+        const ImVec2 origin = ImGui::GetItemRectMin();
+        const ImVec2 mouse = ImGui::GetIO().MousePos;
+        const int x = static_cast<int>((mouse.x - origin.x) / pixel_size);
+        const int y = static_cast<int>((mouse.y - origin.y) / pixel_size);
+        if (x >= 0 && x < CHIP8::display_width && y >= 0 && y < CHIP8::display_height) {
+            EMULATION::send(*m.emulator, {CommandKind::toggle_pixel, x, y});
+        }
+    }
+    ImGui::End();
+}
+
+#if CHIP8_PROFILE
+/* Live top entries of the execution counts, the full counts go to file with Save Profile. */
+inline auto profile_view(EMULATION::Emulator &e, const EMULATION::Frame &f) -> void {
+    bool profiling = f.profiling;
+    if (ImGui::Checkbox("Profile", &profiling)) EMULATION::send(e, {CommandKind::set_profiling, profiling ? 1 : 0});
+    ImGui::SameLine();
+    if (ImGui::Button("Reset Profile")) EMULATION::send(e, {CommandKind::reset_profile});
+    ImGui::SameLine();
+    if (ImGui::Button("Save Profile")) EMULATION::send(e, {CommandKind::save_profile});
+    if (f.profiled == 0) return;
+
+    ImGui::Text("Profiled Instructions: %llu", static_cast<unsigned long long>(f.profiled));
+    const auto share = [&f](uint64_t n) { return 100.0 * static_cast<double>(n) / static_cast<double>(f.profiled); };
+    if (ImGui::BeginTable("Profile", 3, ImGuiTableFlags_Borders)) {
+        ImGui::TableSetupColumn("Opcode");
+        ImGui::TableSetupColumn("PC");
+        ImGui::TableSetupColumn("Block Entries");
+        ImGui::TableHeadersRow();
+        for (size_t k = 0; k < CHIP8::profile_top_n; ++k) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            if (const CHIP8::ProfileEntry &op = f.profile_ops[k]; op.count) {
+                const std::string_view name = CHIP8::op_mnemonic(static_cast<CHIP8::Op>(op.key));
+                ImGui::Text("%.*s %5.1f%%", static_cast<int>(name.size()), name.data(), share(op.count));
+            }
+            ImGui::TableNextColumn();
+            if (const CHIP8::ProfileEntry &pc = f.profile_pcs[k]; pc.count) {
+                ImGui::Text("0x%03X %5.1f%%", pc.key, share(pc.count));
+            }
+            ImGui::TableNextColumn();
+            if (const CHIP8::ProfileEntry &block = f.profile_blocks[k]; block.count) {
+                ImGui::Text("0x%03X %llu", block.key, static_cast<unsigned long long>(block.count));
             }
         }
-        ImGui::PopStyleVar();
+        ImGui::EndTable();
+    }
+}
+#endif
+
+/* Internals and controls of the active machine. */
+inline auto machine_window(Machine &m, const EMULATION::Frame &f) -> void {
+    EMULATION::Emulator &e = *m.emulator;
+    ImGui::Begin("Chip8");
+    if (global.machines.size() > 1) {
+        ImGui::Text("Machine: %s (%zu of %zu, focus a display to switch)", m.name.c_str(), global.active + 1,
+            global.machines.size());
     }
     { // Chip8 Internals
         {
@@ -52,10 +235,10 @@ inline auto display_grid() -> void {
             std::ostringstream oss;
 
             for (int rel = -LOOKBACK; rel <= LOOKFORWARD; ++rel) {
-                int addr = static_cast<int>(chip8.PC) + rel * BYTES_PER_INSTR;
-                if (addr < 0 || addr + 1 >= chip8.mem.size()) continue;
+                int addr = static_cast<int>(f.PC) + rel * BYTES_PER_INSTR;
+                if (addr < 0 || addr + 1 >= f.mem.size()) continue;
 
-                WORD opcode = (chip8.mem[addr] << 8) | chip8.mem[addr + 1];
+                WORD opcode = (f.mem[addr] << 8) | f.mem[addr + 1];
                 std::string dis = CHIP8::disassemble(opcode);
 
                 oss << (rel == 0 ? "-> " : "   ")
@@ -78,34 +261,106 @@ inline auto display_grid() -> void {
                 ImGuiInputTextFlags_ReadOnly);
         }
 
-        BYTE mem_at_I = chip8.mem[chip8.I];
+        BYTE mem_at_I = f.mem[f.I];
         ImGui::Text("Index Register (I): 0x%03X (Mem[I] = 0x%02X)",
-            chip8.I, mem_at_I);
-
-        ImGui::Text("Stack Pointer: %d", chip8.stack_pointer);
-        ImGui::Text("Delay Timer: %d", chip8.delay_timer);
-        ImGui::Text("Sound Timer: %d", chip8.sound_timer);
-        ImGui::Text("Iteration Counter: %d", chip8.iteration_counter);
+            f.I, mem_at_I);
+
+        ImGui::Text("Stack Pointer: %d", f.stack_pointer);
+        ImGui::Text("Delay Timer: %d", f.delay_timer);
+        ImGui::Text("Sound Timer: %d", f.sound_timer);
+        ImGui::Text("Iteration Counter: %llu", static_cast<unsigned long long>(f.iteration_counter));
+#if CHIP8_PROFILE
+        profile_view(e, f);
+#endif
+
+        float ips = static_cast<float>(f.instructions_per_second);
+        if (ImGui::SliderFloat("Instructions / s", &ips, 60.0f, 100'000.0f, "%.0f", ImGuiSliderFlags_Logarithmic)) {
+            EMULATION::send(e, {CommandKind::set_rate, 0, 0, ips});
+        }
+        bool counted = f.timer_mode == CHIP8::TimerMode::instructions;
+        int per_tick = static_cast<int>(f.instructions_per_tick);
+        bool timers_changed = false;
+        if (ImGui::Checkbox("Tick timers by instruction count", &counted)) {
+            timers_changed = true;
+            // Start out at 60Hz for the current rate
+            if (counted) per_tick = std::max(1, static_cast<int>(std::lround(f.instructions_per_second / CONSTANTS::timer_frequency)));
+        }
+        if (counted) {
+            ImGui::SameLine();
+            timers_changed |= ImGui::SliderInt("Instr / Tick", &per_tick, 1, 2000, "%d", ImGuiSliderFlags_Logarithmic);
+        }
+        if (timers_changed) {
+            const auto mode = counted ? CHIP8::TimerMode::instructions : CHIP8::TimerMode::host;
+            EMULATION::send(e, {CommandKind::set_timers, static_cast<int>(mode), per_tick});
+        }
+        ImGui::Text("Emulated Frames: %llu (dropped %.3f s)",
+            static_cast<unsigned long long>(f.frames_completed), f.time_dropped);
+
+        int dispatch = static_cast<int>(f.dispatch);
+        ImGui::Text("Dispatch:");
+        ImGui::SameLine();
+        ImGui::RadioButton("Table", &dispatch, static_cast<int>(CHIP8::Dispatch::table));
+        ImGui::SameLine();
+        ImGui::RadioButton("Switch", &dispatch, static_cast<int>(CHIP8::Dispatch::switched));
+        ImGui::SameLine();
+        ImGui::RadioButton("JIT", &dispatch, static_cast<int>(CHIP8::Dispatch::jit));
+        if (dispatch != static_cast<int>(f.dispatch)) {
+            EMULATION::send(e, {CommandKind::set_dispatch, dispatch});
+        }
+        if (f.dispatch == CHIP8::Dispatch::table) {
+            ImGui::SameLine();
+            bool fuse = f.fuse_superinstructions;
+            if (ImGui::Checkbox("Fuse", &fuse)) {
+                EMULATION::send(e, {CommandKind::set_fuse, fuse ? 1 : 0});
+            }
+        }
 
         if (ImGui::BeginTable("VX Registers", 8)) {
             for (int i = 0; i < 16; ++i) {
                 ImGui::TableNextColumn();
-                ImGui::Text("V%X = 0x%02X", i, chip8.VX[i]);
+                ImGui::Text("V%X = 0x%02X", i, f.VX[i]);
             }
             ImGui::EndTable();
         }
     }
+    { // Rewind
+        ImGui::Separator();
+        bool paused = f.paused;
+        if (ImGui::Checkbox("Paused", &paused)) {
+            EMULATION::send(e, {CommandKind::set_paused, paused ? 1 : 0});
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Step Back (Backspace)")) EMULATION::send(e, {CommandKind::step_back});
+        if (f.rewind_frames > 1) {
+            const int oldest = static_cast<int>(f.rewind_oldest);
+            const int newest = static_cast<int>(f.rewind_oldest + f.rewind_frames - 1);
+            int cursor = static_cast<int>(f.rewind_cursor);
+            if (ImGui::SliderInt("Rewind Frame", &cursor, oldest, newest)) {
+                EMULATION::send(e, {CommandKind::seek, cursor});
+            }
+        }
+        constexpr double mib = 1024.0 * 1024.0;
+        ImGui::Text("History: %.1f s in %.2f / %.0f MiB",
+            static_cast<double>(f.rewind_frames) / CONSTANTS::timer_frequency,
+            static_cast<double>(f.rewind_bytes) / mib, static_cast<double>(f.rewind_capacity) / mib);
+
+        if (!f.movie_recording) {
+            if (ImGui::Button("Record Movie")) EMULATION::send(e, {CommandKind::start_movie});
+        } else {
+            if (ImGui::Button("Stop Movie")) EMULATION::send(e, {CommandKind::stop_movie});
+            ImGui::SameLine();
+            ImGui::Text("Recording to %s, %zu inputs", e.movie_path.c_str(), f.movie_inputs);
+        }
+    }
     { // Keypad
     }
     ImGui::End();
 }
 
-inline auto keypad() -> void {
+inline auto keypad(Machine &m, const EMULATION::Frame &f) -> void {
     ImGui::Begin("Keypad");
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 4));
 
-    // grab raw SDL keyboard state
-    const Uint8 *keys = SDL_GetKeyboardState(nullptr);
     auto &style = ImGui::GetStyle();
 
     // mapping: button label, SDL scancode, CHIP-8 keypad index
@@ -136,18 +391,20 @@ inline auto keypad() -> void {
         {"F", SDL_SCANCODE_V, 0xF},
     };
 
-    // (re)initialize all keys to “up” each frame
-    for (int i = 0; i < 16; ++i)
-        chip8.keypad[i] = 0;
+    // Keys pressed by mouse-click last frame are released again, on the machine they were pressed on
+    static std::array<bool, 16> clicked = {};
+    static EMULATION::Emulator *clicked_on = nullptr;
+    for (int i = 0; i < 16; ++i) {
+        if (clicked[i]) EMULATION::send(*clicked_on, {CommandKind::key_up, i});
+        clicked[i] = false;
+    }
+    clicked_on = m.emulator.get();
 
     // render 4×4 grid
     for (int i = 0; i < 16; ++i) {
         const auto &km = keymap[i];
-        bool isDown = keys[km.sc];
-
-        // if held, light it up
-        if (isDown)
-            chip8.keypad[km.idx] = 1;
+        // Keyboard presses reach the machine via INPUT::handle_event, this only shows its keypad state
+        bool isDown = f.keypad[km.idx];
 
         // pick colors: default vs “active” tint
         ImVec4 col = isDown ? style.Colors[ImGuiCol_ButtonActive] : style.Colors[ImGuiCol_Button];
@@ -162,7 +419,8 @@ inline auto keypad() -> void {
         std::string lbl = std::string(km.label) + "##key_" + km.label;
         if (ImGui::Button(lbl.c_str(), ImVec2(40, 40))) {
             // also allow mouse-click to press
-            chip8.keypad[km.idx] = 1;
+            EMULATION::send(*m.emulator, {CommandKind::key_down, km.idx});
+            clicked[km.idx] = true;
         }
 
         ImGui::PopStyleColor(3);
@@ -185,6 +443,11 @@ inline auto gui_debug() -> void {
     ImGui::ColorEdit3("Background", &global.color.background.r);
     ImGui::ColorEdit3("Pixel On", &global.color.pixel_on.r);
     ImGui::ColorEdit3("Pixel Off", &global.color.pixel_off.r);
+    ImGui::Checkbox("Phosphor", &global.phosphor.enabled);
+    if (global.phosphor.enabled) {
+        ImGui::SameLine();
+        ImGui::SliderFloat("Decay", &global.phosphor.decay, 0.0f, 0.95f, "%.2f");
+    }
     ImGui::Text("Frame Counter: %d", global.sim.frame_counter);
     ImGui::Text("Runtime: %s",
         format_duration(global.sim.total_runtime).c_str());
@@ -194,8 +457,17 @@ inline auto gui_debug() -> void {
         global.input.mouse_pos.y);
     ImGui::End();
 
-    display_grid();
-    keypad();
+    const size_t active = global.active; // Focus changes below take effect next frame
+    for (size_t k = 0; k < global.machines.size(); ++k) {
+        Machine &m = global.machines[k];
+        const EMULATION::Frame &f = EMULATION::latest_frame(*m.emulator);
+        update_display_texture(m.display, f);
+        display_window(m, k);
+        if (k == active) {
+            machine_window(m, f);
+            keypad(m, f);
+        }
+    }
     ImGui::Render();
 }
 
@@ -0,0 +1,269 @@
+/* danielsinkin97@gmail.com */
+
+/*
+Runs every combination of ROM x quirk config x cycle budget headlessly, spread over all cores, and
+writes one JSON record per run for regression checks and quirk sweeps.
+
+    chip8_batch [ROM | DIR ...] [--suite] [--cycles N[,N...]] [--configs default|all]
+                [--dispatch table|switch|jit] [--fuse] [--instructions-per-tick N]
+                [--seed N] [--threads N] [--output FILE]
+
+A directory contributes every *.ch8 file in it, --suite the bundled test suite and Pong.
+--configs all sweeps all 16 combinations of the four quirk flags. Runs are independent machines in
+TimerMode::instructions seeded with --seed (default 0), so the same batch always produces the same
+framebuffer hashes and digests, whatever the thread count. A ROM that panics is recorded with its
+error instead of ending the batch.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "chip8/chip8.hpp"
+#include "chip8/chip8_state.hpp"
+#include "concurrency.hpp"
+#include "log.hpp"
+
+namespace {
+struct Options {
+    std::vector<std::filesystem::path> roms;
+    std::vector<size_t> cycles;
+    bool all_configs = false;
+    CHIP8::Dispatch dispatch = CHIP8::Dispatch::table;
+    bool fuse = false;
+    uint32_t instructions_per_tick = CONSTANTS::n_iter_per_frame;
+    uint64_t seed = 0;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string output = "results.json";
+};
+
+struct Rom {
+    std::filesystem::path path;
+    std::vector<WORD> program;
+};
+
+struct Run {
+    size_t rom = 0; // Index into the loaded ROMs
+    CHIP8::Chip8Config config;
+    size_t cycles = 0;
+};
+
+struct Result {
+    uint64_t framebuffer_hash = 0;
+    uint64_t state_digest = 0;
+    uint64_t iteration_counter = 0;
+    uint64_t instructions_skipped = 0; // Idle loops fast-forwarded, part of iteration_counter
+    WORD PC = 0;
+    double elapsed_ms = 0.0;
+    std::string error; // PANIC message if the ROM crashed the machine
+};
+
+[[noreturn]] auto usage(std::string_view error) -> void {
+    std::cerr << "error: " << error << "\n"
+              << "usage: chip8_batch [ROM | DIR ...] [--suite] [--cycles N[,N...]] [--configs default|all]\n"
+              << "                   [--dispatch table|switch|jit] [--fuse] [--instructions-per-tick N]\n"
+              << "                   [--seed N] [--threads N] [--output FILE]\n";
+    std::exit(EXIT_FAILURE);
+}
+
+auto parse_count(std::string_view arg, std::string_view value) -> size_t {
+    const std::string digits(value);
+    char *end = nullptr;
+    const unsigned long long n = std::strtoull(digits.c_str(), &end, 10);
+    if (digits.empty() || *end != '\0') usage(std::format("{} expects a number, got '{}'", arg, value));
+    return static_cast<size_t>(n);
+}
+
+/* Adds `path`, or every *.ch8 directly inside it, in name order so batches are listed reproducibly. */
+auto add_roms(Options &opt, const std::filesystem::path &path) -> void {
+    if (!std::filesystem::is_directory(path)) {
+        opt.roms.push_back(path);
+        return;
+    }
+    std::vector<std::filesystem::path> found;
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".ch8") found.push_back(entry.path());
+    }
+    std::sort(found.begin(), found.end());
+    opt.roms.insert(opt.roms.end(), found.begin(), found.end());
+}
+
+auto parse_options(int argc, char **argv) -> Options {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool takes_value = arg == "--cycles" || arg == "--configs" || arg == "--dispatch" ||
+                                 arg == "--instructions-per-tick" || arg == "--seed" || arg == "--threads" ||
+                                 arg == "--output";
+        if (takes_value && i + 1 >= argc) usage(std::format("{} needs a value", arg));
+        const std::string_view value = takes_value ? argv[++i] : "";
+        if (arg == "--suite") {
+            for (const char *rom : CONSTANTS::fp_code_test_suite) opt.roms.emplace_back(rom);
+            opt.roms.emplace_back(CONSTANTS::fp_code_pong);
+        } else if (arg == "--cycles") {
+            for (size_t pos = 0; pos <= value.size();) {
+                const size_t comma = std::min(value.find(',', pos), value.size());
+                opt.cycles.push_back(parse_count(arg, value.substr(pos, comma - pos)));
+                pos = comma + 1;
+            }
+        } else if (arg == "--configs") {
+            if (value == "all") opt.all_configs = true;
+            else if (value == "default") opt.all_configs = false;
+            else usage(std::format("unknown config set '{}'", value));
+        } else if (arg == "--dispatch") {
+            if (value == "table") opt.dispatch = CHIP8::Dispatch::table;
+            else if (value == "switch") opt.dispatch = CHIP8::Dispatch::switched;
+            else if (value == "jit") opt.dispatch = CHIP8::Dispatch::jit;
+            else usage(std::format("unknown dispatch '{}'", value));
+        } else if (arg == "--fuse") {
+            opt.fuse = true;
+        } else if (arg == "--instructions-per-tick") {
+            const size_t n = parse_count(arg, value);
+            if (n == 0 || n > UINT32_MAX) usage("--instructions-per-tick must be in [1, 2^32)");
+            opt.instructions_per_tick = static_cast<uint32_t>(n);
+        } else if (arg == "--seed") {
+            opt.seed = parse_count(arg, value);
+        } else if (arg == "--threads") {
+            opt.threads = parse_count(arg, value);
+            if (opt.threads == 0) usage("--threads must be at least 1");
+        } else if (arg == "--output") {
+            opt.output = value;
+        } else if (arg.starts_with("--")) {
+            usage(std::format("unknown option '{}'", arg));
+        } else {
+            add_roms(opt, arg);
+        }
+    }
+    if (opt.roms.empty()) usage("no ROMs given");
+    if (opt.cycles.empty()) opt.cycles.push_back(60 * CONSTANTS::n_iter_per_frame);
+    return opt;
+}
+
+/* FNV-1a over the display rows, equal hashes mean the same picture. */
+auto framebuffer_hash(const CHIP8::Display &display) -> uint64_t {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (const CHIP8::DisplayRow row : display) {
+        for (int k = 0; k < 8; ++k) hash = (hash ^ static_cast<BYTE>(row >> (8 * k))) * 0x100000001B3;
+    }
+    return hash;
+}
+
+auto execute(const Options &opt, const Rom &rom, const Run &run) -> Result {
+    panic_throws = true; // Worker threads run many machines, a crashing ROM must only fail its own run
+    Result result;
+    auto chip8 = std::make_unique<CHIP8::Chip8>(); // Off the stack, profiling builds add large per-address counters
+    CHIP8::Chip8 &c = *chip8;
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        CHIP8::initialise(c);
+        CHIP8::seed_random(c, opt.seed);
+        c.config = run.config;
+        c.dispatch = opt.dispatch;
+        c.fuse_superinstructions = opt.fuse;
+        c.timer_mode = CHIP8::TimerMode::instructions;
+        c.instructions_per_tick = opt.instructions_per_tick;
+        CHIP8::write_program_to_memory(c, rom.program);
+        CHIP8::step(c, run.cycles);
+    } catch (const Panic &e) {
+        result.error = e.what();
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    result.framebuffer_hash = framebuffer_hash(c.display);
+    result.state_digest = CHIP8::state_digest(c);
+    result.iteration_counter = c.iteration_counter;
+    result.instructions_skipped = c.instructions_skipped;
+    result.PC = c.PC;
+    result.elapsed_ms = elapsed.count();
+    return result;
+}
+
+auto to_json(const Rom &rom, const Run &run, const Result &result) -> nlohmann::json {
+    nlohmann::json j;
+    j["rom"] = rom.path.string();
+    j["config"] = {
+        {"legacy_shift", run.config.legacy_shift},
+        {"legacy_add_index", run.config.legacy_add_index},
+        {"modern_add_index_flush_vf", run.config.modern_add_index_flush_vf},
+        {"legacy_memory_dump", run.config.legacy_memory_dump},
+    };
+    j["cycles"] = run.cycles;
+    // Hex strings, JSON numbers lose precision past 2^53 in most readers
+    j["framebuffer_hash"] = std::format("{:016x}", result.framebuffer_hash);
+    j["state_digest"] = std::format("{:016x}", result.state_digest);
+    j["iteration_counter"] = result.iteration_counter;
+    j["instructions_skipped"] = result.instructions_skipped;
+    j["PC"] = result.PC;
+    j["elapsed_ms"] = result.elapsed_ms;
+    if (!result.error.empty()) j["error"] = result.error;
+    return j;
+}
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+    const Options opt = parse_options(argc, argv);
+
+    std::vector<Rom> roms;
+    for (const std::filesystem::path &path : opt.roms) {
+        try {
+            roms.push_back(Rom{path, CHIP8::load_ch8(path)});
+        } catch (const std::exception &e) {
+            usage(e.what());
+        }
+    }
+    std::vector<CHIP8::Chip8Config> configs = {CHIP8::Chip8Config{}};
+    if (opt.all_configs) {
+        configs.clear();
+        for (uint8_t bits = 0; bits < 16; ++bits) configs.push_back(CHIP8::STATE::unpack_config(bits));
+    }
+    std::vector<Run> runs;
+    for (size_t r = 0; r < roms.size(); ++r) {
+        for (const CHIP8::Chip8Config &config : configs) {
+            for (const size_t cycles : opt.cycles) runs.push_back(Run{r, config, cycles});
+        }
+    }
+
+    std::vector<Result> results(runs.size());
+    const auto start = std::chrono::steady_clock::now();
+    CONCURRENCY::parallel_for(runs.size(), opt.threads, [&](size_t k) {
+        results[k] = execute(opt, roms[runs[k].rom], runs[k]);
+    });
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t failed = 0;
+    uint64_t instructions = 0;
+    nlohmann::json report;
+    report["runs"] = nlohmann::json::array();
+    for (size_t k = 0; k < runs.size(); ++k) {
+        if (!results[k].error.empty()) {
+            ++failed;
+            std::cerr << std::format("{}: {}\n", roms[runs[k].rom].path.string(), results[k].error);
+        }
+        instructions += results[k].iteration_counter - results[k].instructions_skipped; // Executed only
+        report["runs"].push_back(to_json(roms[runs[k].rom], runs[k], results[k]));
+    }
+    const double mips = (elapsed.count() > 0.0) ? static_cast<double>(instructions) / elapsed.count() / 1e3 : 0.0;
+    report["threads"] = opt.threads;
+    report["seed"] = opt.seed;
+    report["elapsed_ms"] = elapsed.count();
+    report["instructions"] = instructions;
+    report["mips"] = mips;
+
+    std::ofstream file(opt.output);
+    if (!file) usage("failed to open output file: " + opt.output);
+    file << report.dump(2) << '\n';
+
+    std::cout << std::format("{} runs ({} failed) on {} threads in {:.1f} ms, {} instructions ({:.1f} MIPS)\n",
+        runs.size(), failed, opt.threads, elapsed.count(), instructions, mips);
+    std::cout << std::format("wrote {}\n", opt.output);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
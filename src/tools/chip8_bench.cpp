@@ -0,0 +1,395 @@
+/* danielsinkin97@gmail.com */
+
+/*
+Benchmarks for the emulator core, on Google Benchmark.
+
+    chip8_bench [--assets DIR] [--baseline FILE] [--tolerance PERCENT] [--benchmark_* ...]
+
+Microbenchmarks time decode, disassemble, draw_sprite, fetch_and_execute on loops of one opcode
+class each and step on every ROM in --assets (default assets/code). The headless benchmarks run a
+synthetic program and every ROM frame by frame on each engine, like chip8_headless does, and report
+MIPS (millions of executed instructions per second, idle loops fast-forwarded don't count) and FPS
+(emulated frames per second).
+
+Results go to JSON with --benchmark_out=FILE --benchmark_out_format=json. With --baseline the run is
+compared against such a file, and any benchmark more than --tolerance percent (default 10) slower
+than its baseline fails the run. Timings only compare on the same host, so no baseline is committed,
+record one on the machine that gates, from a CHIP8_BUILD_BENCHMARKS build with the ROMs in --assets:
+
+    ./chip8_bench --benchmark_out=baseline.json --benchmark_out_format=json --benchmark_context=host=<machine>
+
+and record it again the same way after intended changes.
+*/
+
+#include <algorithm>
+#include <array>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chip8/chip8.hpp"
+#include "chip8/chip8_writer.hpp"
+#include "log.hpp"
+
+namespace {
+struct Options {
+    std::filesystem::path assets = "assets/code";
+    std::string baseline;
+    double tolerance = 10.0; // Percent
+};
+
+[[noreturn]] auto usage(std::string_view error) -> void {
+    std::cerr << "error: " << error << "\n"
+              << "usage: chip8_bench [--assets DIR] [--baseline FILE] [--tolerance PERCENT] [--benchmark_* ...]\n";
+    std::exit(EXIT_FAILURE);
+}
+
+/* Takes our own options out of argv, everything left is for Google Benchmark. */
+auto parse_options(int &argc, char **argv) -> Options {
+    Options opt;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg != "--assets" && arg != "--baseline" && arg != "--tolerance") {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) usage(std::format("{} needs a value", arg));
+        const std::string value = argv[++i];
+        if (arg == "--assets") {
+            opt.assets = value;
+        } else if (arg == "--baseline") {
+            opt.baseline = value;
+        } else {
+            char *end = nullptr;
+            opt.tolerance = std::strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || opt.tolerance < 0.0) {
+                usage(std::format("--tolerance expects a non-negative number, got '{}'", value));
+            }
+        }
+    }
+    argc = kept;
+    return opt;
+}
+
+/* A machine ready to run, seeded so every benchmark run executes the same instructions. */
+auto make_machine() -> std::unique_ptr<CHIP8::Chip8> {
+    auto c = std::make_unique<CHIP8::Chip8>(); // Off the stack, profiling builds add large per-address counters
+    CHIP8::initialise(*c);
+    CHIP8::seed_random(*c, 0);
+    c->timer_mode = CHIP8::TimerMode::instructions;
+    return c;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Microbenchmarks */
+
+auto bm_decode(benchmark::State &state) -> void {
+    WORD opcode = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CHIP8::decode(opcode));
+        ++opcode; // Every word in turn, valid or not
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+auto bm_disassemble(benchmark::State &state) -> void {
+    WORD opcode = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CHIP8::disassemble(opcode));
+        ++opcode;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Arg: sprite height N, the sprite moves every draw so it straddles the edges and wraps as in games. */
+auto bm_draw_sprite(benchmark::State &state) -> void {
+    auto c = make_machine();
+    c->I = CONSTANTS::rom_font_start;
+    const BYTE n = static_cast<BYTE>(state.range(0));
+    for (auto _ : state) {
+        CHIP8::draw_sprite(*c, 0x0, 0x1, n);
+        c->VX[0x0] = static_cast<BYTE>(c->VX[0x0] + 7);
+        c->VX[0x1] = static_cast<BYTE>(c->VX[0x1] + 3);
+        benchmark::DoNotOptimize(c->display);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* A loop body made of one class of opcodes, run from `loop` until the closing jump back. */
+struct OpcodeClass {
+    const char *name;
+    void (*write)(CHIP8::ProgramWriter &);
+};
+
+// All registers start at 0, the skips below are written so that the skipped words are filler
+constexpr std::array<OpcodeClass, 8> opcode_classes = {{
+    {"load", [](CHIP8::ProgramWriter &pw) {
+         pw.ld_vx_byte(0x0, 0x12);
+         pw.add_vx_byte(0x1, 0x03);
+         pw.ld_vx_byte(0x2, 0x80);
+         pw.add_vx_byte(0x3, 0x81);
+     }},
+    {"alu", [](CHIP8::ProgramWriter &pw) {
+         pw.add_vx_byte(0x1, 0x35); // Keeps the operands changing
+         pw.ld_vx_vy(0x2, 0x1);
+         pw.or_vx_vy(0x3, 0x2);
+         pw.and_vx_vy(0x4, 0x3);
+         pw.xor_vx_vy(0x5, 0x4);
+         pw.add_vx_vy(0x6, 0x5);
+         pw.sub_vx_vy(0x7, 0x6);
+         pw.shr_vx(0x8, 0x7);
+         pw.subn_vx_vy(0x9, 0x8);
+         pw.shl_vx(0xA, 0x9);
+     }},
+    {"skip", [](CHIP8::ProgramWriter &pw) {
+         pw.skip_eq(0x0, 0x01);     // Not taken
+         pw.skip_not_eq(0x0, 0x00); // Not taken
+         pw.skip_eq_reg(0x0, 0x1);  // Taken
+         pw.ld_vx_byte(0x2, 0x00);
+         pw.skip_not_eq_reg(0x0, 0x1); // Not taken
+     }},
+    {"flow", [](CHIP8::ProgramWriter &pw) {
+         const WORD at = pw.addr;
+         pw.call(static_cast<WORD>(at + 4));
+         pw.jmp(static_cast<WORD>(at + 6));
+         pw.ret();
+     }},
+    {"index", [](CHIP8::ProgramWriter &pw) {
+         pw.ld_i_addr(0x600);
+         pw.add_i_vx(0x1);
+         pw.ld_f_vx(0x2);
+     }},
+    {"memory", [](CHIP8::ProgramWriter &pw) {
+         pw.ld_i_addr(0x600);
+         pw.bcd_vx(0x3);
+         pw.dump_vx(0x7);
+         pw.fill_vx(0x7);
+     }},
+    {"draw", [](CHIP8::ProgramWriter &pw) {
+         pw.ld_f_vx(0x2);
+         pw.drw(0x0, 0x1, 5);
+         pw.add_vx_byte(0x0, 0x07);
+         pw.drw(0x0, 0x1, 5);
+     }},
+    {"timers_keys_rng", [](CHIP8::ProgramWriter &pw) {
+         pw.ld_vx_dt(0x0);
+         pw.set_delay(0x1);
+         pw.set_sound(0x1);
+         pw.rnd_vx_byte(0x2, 0xFF);
+         pw.ld_vx_byte(0xB, 0x05);
+         pw.skip_pressed(0xB);     // Not taken
+         pw.skip_not_pressed(0xB); // Taken
+         pw.ld_vx_byte(0x4, 0x00);
+     }},
+}};
+
+auto write_class_loop(CHIP8::Chip8 &c, const OpcodeClass &op_class) -> void {
+    CHIP8::ProgramWriter pw(c);
+    const WORD loop = pw.addr;
+    op_class.write(pw);
+    pw.jmp(loop);
+}
+
+auto bm_fetch_and_execute(benchmark::State &state, const OpcodeClass &op_class) -> void {
+    auto c = make_machine();
+    write_class_loop(*c, op_class);
+    for (auto _ : state) CHIP8::fetch_and_execute(*c);
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Every opcode class one after another in one loop, a stand-in for a game when no ROMs are around. */
+auto mixed_program() -> std::vector<WORD> {
+    auto c = make_machine();
+    CHIP8::ProgramWriter pw(*c);
+    const WORD loop = pw.addr;
+    for (const OpcodeClass &op_class : opcode_classes) op_class.write(pw);
+    pw.jmp(loop);
+    std::vector<WORD> program;
+    for (WORD addr = CONSTANTS::rom_program_start; addr < pw.addr; addr += 2) {
+        program.push_back(static_cast<WORD>(c->mem[addr] << 8 | c->mem[addr + 1]));
+    }
+    return program;
+}
+
+constexpr size_t instructions_per_step = 1000;
+
+auto bm_step_rom(benchmark::State &state, const std::vector<WORD> &program) -> void {
+    panic_throws = true; // A ROM that crashes fails its benchmark, not the whole run
+    auto c = make_machine();
+    try {
+        CHIP8::write_program_to_memory(*c, program);
+        for (auto _ : state) CHIP8::step(*c, instructions_per_step);
+    } catch (const Panic &e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+    // Fast-forwarded idle instructions were never executed, they would inflate the rate
+    const uint64_t budget = static_cast<uint64_t>(state.iterations()) * instructions_per_step;
+    state.SetItemsProcessed(static_cast<int64_t>(budget - c->instructions_skipped));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Headless macro benchmarks */
+
+struct Engine {
+    const char *name;
+    CHIP8::Dispatch dispatch;
+    bool fuse;
+};
+constexpr std::array<Engine, 4> engines = {{
+    {"table", CHIP8::Dispatch::table, false},
+    {"fused", CHIP8::Dispatch::table, true},
+    {"switch", CHIP8::Dispatch::switched, false},
+    {"jit", CHIP8::Dispatch::jit, false},
+}};
+
+/* One iteration is one emulated frame, as chip8_headless --frames runs them. */
+auto bm_headless(benchmark::State &state, const std::vector<WORD> &program, Engine engine) -> void {
+    panic_throws = true;
+    auto c = make_machine();
+    c->dispatch = engine.dispatch;
+    c->fuse_superinstructions = engine.fuse;
+    try {
+        CHIP8::write_program_to_memory(*c, program);
+        const uint64_t counter_before = c->iteration_counter;
+        const uint64_t skipped_before = c->instructions_skipped;
+        const auto start = std::chrono::steady_clock::now();
+        for (auto _ : state) {
+            CHIP8::step(*c, c->instructions_per_tick);
+            CHIP8::end_frame(*c);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double frames = static_cast<double>(state.iterations());
+        // Fast-forwarded idle instructions count towards the frame but were never executed
+        const uint64_t executed =
+            (c->iteration_counter - counter_before) - (c->instructions_skipped - skipped_before);
+        state.counters["FPS"] = frames / elapsed.count();
+        state.counters["MIPS"] = static_cast<double>(executed) / elapsed.count() / 1e6;
+    } catch (const Panic &e) {
+        state.SkipWithError(e.what());
+    }
+}
+
+/* Every non-empty *.ch8 in `dir`, by name. Missing ROMs just mean fewer benchmarks. */
+auto load_roms(const std::filesystem::path &dir) -> std::map<std::string, std::vector<WORD>> {
+    std::map<std::string, std::vector<WORD>> roms;
+    if (!std::filesystem::is_directory(dir)) {
+        LOG_WARN("No ROM directory at {}, skipping the ROM benchmarks", dir.string());
+        return roms;
+    }
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".ch8") continue;
+        std::vector<WORD> program = CHIP8::load_ch8(entry.path());
+        if (!program.empty()) roms.emplace(entry.path().stem().string(), std::move(program));
+    }
+    return roms;
+}
+
+auto register_benchmarks(const std::map<std::string, std::vector<WORD>> &roms) -> void {
+    benchmark::RegisterBenchmark("decode", bm_decode);
+    benchmark::RegisterBenchmark("disassemble", bm_disassemble);
+    benchmark::RegisterBenchmark("draw_sprite", bm_draw_sprite)->Arg(1)->Arg(5)->Arg(15);
+    for (const OpcodeClass &op_class : opcode_classes) {
+        benchmark::RegisterBenchmark(std::format("fetch_and_execute/{}", op_class.name).c_str(), bm_fetch_and_execute,
+            op_class);
+    }
+    for (const auto &[name, program] : roms) {
+        benchmark::RegisterBenchmark(std::format("step/{}", name).c_str(), bm_step_rom, program);
+    }
+    static const std::vector<WORD> mixed = mixed_program();
+    for (const Engine &engine : engines) {
+        benchmark::RegisterBenchmark(std::format("headless/mixed/{}", engine.name).c_str(), bm_headless, mixed, engine)
+            ->Unit(benchmark::kMicrosecond);
+        for (const auto &[name, program] : roms) {
+            benchmark::RegisterBenchmark(std::format("headless/{}/{}", name, engine.name).c_str(), bm_headless,
+                program, engine)->Unit(benchmark::kMicrosecond);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* Baseline comparison */
+
+/* Console output as usual, plus the real time per iteration of every run, in nanoseconds. */
+class CollectingReporter : public benchmark::ConsoleReporter {
+public:
+    std::map<std::string, double> real_time_ns;
+
+    auto ReportRuns(const std::vector<Run> &runs) -> void override {
+        for (const Run &run : runs) {
+            if (run.error_occurred || run.run_type != Run::RT_Iteration) continue;
+            real_time_ns[run.benchmark_name()] = run.GetAdjustedRealTime() * 1e9 / benchmark::GetTimeUnitMultiplier(run.time_unit);
+        }
+        ConsoleReporter::ReportRuns(runs);
+    }
+};
+
+auto to_ns(double time, std::string_view unit) -> double {
+    if (unit == "ns") return time;
+    if (unit == "us") return time * 1e3;
+    if (unit == "ms") return time * 1e6;
+    if (unit == "s") return time * 1e9;
+    throw std::runtime_error(std::format("Unknown time unit '{}'", unit));
+}
+
+/* Prints current against baseline for every benchmark in both, returns the number of regressions. */
+auto compare_to_baseline(const std::map<std::string, double> &current, const std::string &path, double tolerance)
+    -> size_t {
+    std::ifstream file(path);
+    if (!file) usage("failed to open baseline file: " + path);
+    std::map<std::string, double> baseline;
+    try {
+        const nlohmann::json j = nlohmann::json::parse(file);
+        for (const nlohmann::json &run : j.at("benchmarks")) {
+            if (run.value("run_type", "iteration") != "iteration" || run.contains("error_occurred")) continue;
+            baseline[run.at("name").get<std::string>()] =
+                to_ns(run.at("real_time").get<double>(), run.at("time_unit").get<std::string>());
+        }
+    } catch (const std::exception &e) {
+        usage(std::format("invalid baseline file {}: {}", path, e.what()));
+    }
+
+    size_t regressions = 0;
+    std::cout << std::format("\n{:<40} {:>14} {:>14} {:>9}\n", "Compared to " + path, "baseline ns", "current ns", "change");
+    for (const auto &[name, ns] : current) {
+        const auto it = baseline.find(name);
+        if (it == baseline.end()) {
+            std::cout << std::format("{:<40} {:>14} {:>14.1f} {:>9}\n", name, "-", ns, "new");
+            continue;
+        }
+        const double change = (ns / it->second - 1.0) * 100.0;
+        const bool regressed = change > tolerance;
+        regressions += regressed;
+        std::cout << std::format("{:<40} {:>14.1f} {:>14.1f} {:>+8.1f}%{}\n", name, it->second, ns, change,
+            regressed ? "  REGRESSION" : "");
+    }
+    std::cout << std::format("{} regressions beyond {:.1f}%\n", regressions, tolerance);
+    return regressions;
+}
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+    const Options opt = parse_options(argc, argv);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return EXIT_FAILURE;
+
+    const std::map<std::string, std::vector<WORD>> roms = load_roms(opt.assets);
+    register_benchmarks(roms);
+    CollectingReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    if (opt.baseline.empty()) return EXIT_SUCCESS;
+    return compare_to_baseline(reporter.real_time_ns, opt.baseline, opt.tolerance) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,230 @@
+/* danielsinkin97@gmail.com */
+
+/*
+Runs a ROM without any window, GL context or audio device and prints the final machine state.
+
+    chip8_headless <rom.ch8> [--frames N | --cycles N] [--instructions-per-tick N]
+                   [--dispatch table|switch|jit] [--fuse]
+                   [--legacy-shift] [--legacy-add-index] [--flush-vf] [--legacy-memory-dump]
+                   [--seed N] [--load-state FILE] [--save-state FILE] [--replay MOVIE]
+                   [--profile PREFIX]
+
+--load-state resumes a run saved with --save-state (the ROM is optional then, its state includes
+memory), quirk, dispatch and seed flags given on the command line override the saved ones.
+--replay runs a movie recorded in the frontend from its own starting state instead of a ROM (the
+--frames / --cycles budget is ignored, the movie runs to its end) and fails unless the final state
+matches the recording bit for bit, whichever --dispatch replays it.
+--profile counts every executed instruction and writes PREFIX.csv and PREFIX.folded (see
+chip8_profile.hpp), it needs a build with CHIP8_PROFILE.
+
+Timers run in TimerMode::instructions, one tick (= one frame for --frames) per
+--instructions-per-tick instructions (default CONSTANTS::n_iter_per_frame) instead of at wall-clock
+60Hz, so a run is reproducible and goes as fast as the host allows.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "chip8/chip8.hpp"
+#include "chip8/chip8_movie.hpp"
+#include "chip8/chip8_profile.hpp"
+#include "chip8/chip8_state.hpp"
+
+namespace {
+struct Options {
+    std::string rom;
+    std::string load_state;
+    std::string save_state;
+    std::string replay;
+    std::string profile;
+    size_t cycles = 0;
+    size_t frames = 60; // Used unless --cycles is given
+    bool cycles_given = false;
+    std::optional<uint32_t> instructions_per_tick;
+    // Unset options keep what the ROM defaults to or what a loaded state / movie holds
+    std::optional<CHIP8::Dispatch> dispatch;
+    bool fuse = false;
+    std::optional<CHIP8::Chip8Config> config;
+    std::optional<uint64_t> seed;
+};
+
+[[noreturn]] auto usage(std::string_view error) -> void {
+    std::cerr << "error: " << error << "\n"
+              << "usage: chip8_headless <rom.ch8> [--frames N | --cycles N] [--instructions-per-tick N]\n"
+              << "                      [--dispatch table|switch|jit] [--fuse]\n"
+              << "                      [--legacy-shift] [--legacy-add-index] [--flush-vf] [--legacy-memory-dump]\n"
+              << "                      [--seed N] [--load-state FILE] [--save-state FILE] [--replay MOVIE]\n"
+              << "                      [--profile PREFIX]\n";
+    std::exit(EXIT_FAILURE);
+}
+
+auto parse_count(std::string_view arg, const char *value) -> size_t {
+    if (!value) usage(std::format("{} needs a value", arg));
+    char *end = nullptr;
+    const unsigned long long n = std::strtoull(value, &end, 10);
+    if (*end != '\0') usage(std::format("{} expects a number, got '{}'", arg, value));
+    return static_cast<size_t>(n);
+}
+
+auto parse_options(int argc, char **argv) -> Options {
+    Options opt;
+    const auto quirks = [&opt]() -> CHIP8::Chip8Config & { return opt.config ? *opt.config : opt.config.emplace(); };
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (arg == "--frames") {
+            opt.frames = parse_count(arg, value);
+            opt.cycles_given = false;
+            ++i;
+        } else if (arg == "--cycles") {
+            opt.cycles = parse_count(arg, value);
+            opt.cycles_given = true;
+            ++i;
+        } else if (arg == "--instructions-per-tick") {
+            const size_t n = parse_count(arg, value);
+            if (n == 0 || n > UINT32_MAX) usage("--instructions-per-tick must be in [1, 2^32)");
+            opt.instructions_per_tick = static_cast<uint32_t>(n);
+            ++i;
+        } else if (arg == "--dispatch") {
+            const std::string_view name = value ? value : "";
+            if (name == "table") opt.dispatch = CHIP8::Dispatch::table;
+            else if (name == "switch") opt.dispatch = CHIP8::Dispatch::switched;
+            else if (name == "jit") opt.dispatch = CHIP8::Dispatch::jit;
+            else usage(std::format("unknown dispatch '{}'", name));
+            ++i;
+        } else if (arg == "--fuse") {
+            opt.fuse = true;
+        } else if (arg == "--legacy-shift") {
+            quirks().legacy_shift = true;
+        } else if (arg == "--legacy-add-index") {
+            quirks().legacy_add_index = true;
+        } else if (arg == "--flush-vf") {
+            quirks().modern_add_index_flush_vf = true;
+        } else if (arg == "--legacy-memory-dump") {
+            quirks().legacy_memory_dump = true;
+        } else if (arg == "--seed") {
+            opt.seed = parse_count(arg, value);
+            ++i;
+        } else if (arg == "--load-state" || arg == "--save-state" || arg == "--replay") {
+            if (!value) usage(std::format("{} needs a value", arg));
+            (arg == "--load-state" ? opt.load_state : arg == "--save-state" ? opt.save_state : opt.replay) = value;
+            ++i;
+        } else if (arg == "--profile") {
+            if (!value) usage(std::format("{} needs a value", arg));
+            if (!CHIP8_PROFILE) usage("--profile needs a build with CHIP8_PROFILE");
+            opt.profile = value;
+            ++i;
+        } else if (arg.starts_with("--")) {
+            usage(std::format("unknown option '{}'", arg));
+        } else if (opt.rom.empty()) {
+            opt.rom = arg;
+        } else {
+            usage("more than one ROM given");
+        }
+    }
+    if (!opt.replay.empty() && (!opt.rom.empty() || !opt.load_state.empty())) {
+        usage("--replay starts from the movie's state, it takes no ROM or --load-state");
+    }
+    if (!opt.replay.empty() && (opt.config || opt.seed || opt.instructions_per_tick)) {
+        usage("--replay can't change quirks, timers or the seed");
+    }
+    if (opt.rom.empty() && opt.load_state.empty() && opt.replay.empty()) usage("no ROM given");
+    return opt;
+}
+
+auto print_state(const CHIP8::Chip8 &c) -> void {
+    std::cout << std::format("PC: {:#05x}  I: {:#05x}  SP: {}  DT: {}  ST: {}  iterations: {}\n",
+        c.PC, c.I, c.stack_pointer, c.delay_timer, c.sound_timer, c.iteration_counter);
+    for (size_t x = 0; x < c.VX.size(); ++x) {
+        std::cout << std::format("V{:X}: {:#04x}{}", x, c.VX[x], (x % 8 == 7) ? "\n" : "  ");
+    }
+    for (const CHIP8::DisplayRow row : c.display) {
+        std::string line;
+        for (int x = 0; x < CHIP8::display_width; ++x) {
+            line += ((row >> (CHIP8::display_width - 1 - x)) & 1) ? '#' : '.';
+        }
+        std::cout << line << '\n';
+    }
+    std::cout << std::format("state digest: {:016x}\n", CHIP8::state_digest(c));
+}
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+    const Options opt = parse_options(argc, argv);
+
+    auto chip8 = std::make_unique<CHIP8::Chip8>(); // Off the stack, profiling builds add large per-address counters
+    CHIP8::Chip8 &c = *chip8;
+    CHIP8::initialise(c);
+    std::optional<CHIP8::Movie> movie;
+    try {
+        if (!opt.replay.empty()) {
+            movie = CHIP8::load_movie_from_file(opt.replay);
+            CHIP8::load_state(c, movie->initial_state);
+        }
+        if (!opt.load_state.empty()) CHIP8::load_state_from_file(c, opt.load_state);
+        if (!opt.rom.empty()) CHIP8::load_program_from_file(c, opt.rom);
+    } catch (const std::exception &e) {
+        usage(e.what());
+    }
+    if (opt.config) c.config = *opt.config;
+    if (opt.dispatch) c.dispatch = *opt.dispatch;
+    if (opt.fuse) c.fuse_superinstructions = true;
+    if (opt.seed) CHIP8::seed_random(c, *opt.seed);
+    if (!movie) {
+        if (c.timer_mode != CHIP8::TimerMode::instructions) {
+            c.timer_mode = CHIP8::TimerMode::instructions;
+            c.tick_phase = 0;
+        }
+        if (opt.instructions_per_tick) c.instructions_per_tick = *opt.instructions_per_tick;
+    }
+
+#if CHIP8_PROFILE
+    c.profiling = !opt.profile.empty();
+#endif
+
+    const uint64_t skipped_before = c.instructions_skipped;
+    const auto start = std::chrono::steady_clock::now();
+    size_t budget = opt.cycles_given ? opt.cycles : opt.frames * c.instructions_per_tick;
+    bool matches = true;
+    if (movie) {
+        matches = CHIP8::play_movie(c, *movie);
+        budget = movie->length;
+    } else {
+        CHIP8::step(c, budget);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    // Idle loops fast-forwarded in O(1) count towards the budget but were never executed
+    const uint64_t skipped = c.instructions_skipped - skipped_before;
+    const uint64_t executed = budget - skipped;
+
+    print_state(c);
+    if (!opt.save_state.empty()) {
+        try {
+            CHIP8::save_state_to_file(c, opt.save_state);
+        } catch (const std::exception &e) {
+            usage(e.what());
+        }
+    }
+#if CHIP8_PROFILE
+    if (!opt.profile.empty()) {
+        try {
+            CHIP8::save_profile_csv(c, opt.profile + ".csv");
+            CHIP8::save_profile_folded(c, opt.profile + ".folded");
+        } catch (const std::exception &e) {
+            usage(e.what());
+        }
+    }
+#endif
+    std::cout << std::format("{} instructions ({} skipped idle) in {:.3f} ms ({:.1f} MIPS)\n", budget, skipped,
+        elapsed.count() * 1e3, (elapsed.count() > 0.0) ? static_cast<double>(executed) / elapsed.count() / 1e6 : 0.0);
+    if (movie) {
+        std::cout << (matches ? "replay matches the recording\n" : "replay diverged from the recording\n");
+    }
+    return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,181 @@
+/* danielsinkin97@gmail.com */
+#pragma once
+
+/*
+Timeline tracing: TRACE_SCOPE("name") records when the enclosing scope started and how long it ran,
+and `save_chrome_trace` writes what every thread recorded as Chrome trace JSON, for chrome://tracing
+or ui.perfetto.dev.
+
+Every thread records into a ring of its own holding its most recent `events_per_thread` scopes.
+Only that thread writes to it, so recording takes no lock and, after the thread's first event,
+never allocates. A dump may run while threads keep recording, it leaves out the events that were
+overwritten while it copied them.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "log.hpp"
+
+namespace TRACE {
+inline constexpr size_t events_per_thread = 1 << 15; // About a minute of frames at 60 Hz, ten scopes each
+
+struct Event {
+    const char *name; // Only the pointer is kept, names must be string literals
+    int64_t start_ns; // Since `epoch`
+    int64_t duration_ns;
+};
+
+inline const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+inline std::atomic<bool> enabled = true;
+
+inline auto now_ns() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+class ThreadBuffer {
+public:
+    explicit ThreadBuffer(uint32_t thread_id) : tid(thread_id) {}
+
+    /* Owning thread only. */
+    auto record(const char *event_name, int64_t start_ns, int64_t duration_ns) -> void {
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        Slot &slot = m_slots[head % events_per_thread];
+        slot.name.store(event_name, std::memory_order_relaxed);
+        slot.start_ns.store(start_ns, std::memory_order_relaxed);
+        slot.duration_ns.store(duration_ns, std::memory_order_relaxed);
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    /* Any thread, appends the events still in the ring to `out`, oldest first. */
+    auto snapshot(std::vector<Event> &out) const -> void {
+        const uint64_t head = m_head.load(std::memory_order_acquire);
+        const size_t copied_from = out.size();
+        const uint64_t first = (head > events_per_thread) ? head - events_per_thread : 0;
+        for (uint64_t k = first; k < head; ++k) {
+            const Slot &slot = m_slots[k % events_per_thread];
+            out.push_back(Event{slot.name.load(std::memory_order_relaxed), slot.start_ns.load(std::memory_order_relaxed),
+                slot.duration_ns.load(std::memory_order_relaxed)});
+        }
+        // Events `after` and up may have been written over the slots just read, as in a seqlock
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t after = m_head.load(std::memory_order_relaxed);
+        const uint64_t valid_from = (after >= events_per_thread) ? after - events_per_thread + 1 : 0;
+        if (valid_from > first) {
+            const size_t torn = std::min(valid_from, head) - first;
+            out.erase(out.begin() + static_cast<std::ptrdiff_t>(copied_from),
+                out.begin() + static_cast<std::ptrdiff_t>(copied_from + torn));
+        }
+    }
+
+    const uint32_t tid;
+    std::string name; // Guarded by the registry mutex
+
+private:
+    struct Slot {
+        std::atomic<const char *> name{nullptr};
+        std::atomic<int64_t> start_ns{0};
+        std::atomic<int64_t> duration_ns{0};
+    };
+    std::unique_ptr<Slot[]> m_slots = std::make_unique<Slot[]>(events_per_thread);
+    std::atomic<uint64_t> m_head{0};
+};
+
+/* Buffers of every thread that ever recorded, kept after the thread exits so its events still get dumped. */
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+inline auto registry() -> Registry & {
+    static Registry r;
+    return r;
+}
+
+inline auto this_thread_buffer() -> ThreadBuffer & {
+    thread_local ThreadBuffer *buffer = [] {
+        Registry &r = registry();
+        const std::lock_guard lock(r.mutex);
+        const auto tid = static_cast<uint32_t>(r.buffers.size() + 1);
+        return r.buffers.emplace_back(std::make_unique<ThreadBuffer>(tid)).get();
+    }();
+    return *buffer;
+}
+
+/* Shown as the name of the calling thread's track. */
+inline auto set_thread_name(std::string name) -> void {
+    ThreadBuffer &buffer = this_thread_buffer();
+    const std::lock_guard lock(registry().mutex);
+    buffer.name = std::move(name);
+}
+
+class Scope {
+public:
+    explicit Scope(const char *name) : m_name(enabled.load(std::memory_order_relaxed) ? name : nullptr) {
+        if (m_name) m_start_ns = now_ns();
+    }
+    ~Scope() {
+        if (m_name) this_thread_buffer().record(m_name, m_start_ns, now_ns() - m_start_ns);
+    }
+    Scope(const Scope &) = delete;
+    auto operator=(const Scope &) -> Scope & = delete;
+
+private:
+    const char *m_name;
+    int64_t m_start_ns = 0;
+};
+
+/* Chrome trace JSON of everything recorded so far, returns the number of events written. */
+inline auto write_chrome_trace(std::ostream &out) -> size_t {
+    Registry &r = registry();
+    const std::lock_guard lock(r.mutex);
+    size_t written = 0;
+    std::vector<Event> events;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char *separator = "\n";
+    for (const std::unique_ptr<ThreadBuffer> &buffer : r.buffers) {
+        if (!buffer->name.empty()) {
+            out << std::format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                separator, buffer->tid, buffer->name);
+            separator = ",\n";
+        }
+        events.clear();
+        buffer->snapshot(events);
+        for (const Event &e : events) {
+            // Microseconds, as the format wants
+            out << std::format("{}{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                separator, e.name, buffer->tid, static_cast<double>(e.start_ns) / 1e3,
+                static_cast<double>(e.duration_ns) / 1e3);
+            separator = ",\n";
+        }
+        written += events.size();
+    }
+    out << "\n]}\n";
+    return written;
+}
+
+inline auto save_chrome_trace(const std::filesystem::path &filepath) -> void {
+    std::ofstream file(filepath);
+    if (!file) {
+        LOG_ERR("Failed to open trace file: {}", filepath.string());
+        return;
+    }
+    const size_t written = write_chrome_trace(file);
+    LOG_INFO("Saved {} trace events to {}", written, filepath.string());
+}
+} // namespace TRACE
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Records the rest of the enclosing scope as one event, `name` must be a string literal
+#define TRACE_SCOPE(name) const TRACE::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
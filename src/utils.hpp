@@ -56,10 +56,3 @@ format_duration(std::chrono::duration<float> duration) -> std::string {
         hrs, mins, secs, millis);
     return std::string(buffer);
 }
-
-[[nodiscard]] inline auto get_random_byte() -> uint8_t {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<int> dist(0, 255);
-    return static_cast<uint8_t>(dist(gen));
-}
\ No newline at end of file